@@ -7,10 +7,24 @@
 #include <stdbool.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 // --- Configurações do Jogo ---
 #define SCREEN_WIDTH 80
 #define SCREEN_HEIGHT 24
+#define MAP_MAX_SIDE 100000 // lado máximo do mapa (--map); maior que a tela, a câmera segue o helicóptero
 
 #define HELICOPTER_CHAR 'H'
 #define BATTERY_CHAR 'B'
@@ -20,9 +34,12 @@
 #define DEPOT_CHAR 'D'
 #define BRIDGE_CHAR '='
 
+// Valores padrão; as quantidades reais vêm de WorldConfig (linha de comando ou --config)
 #define INITIAL_SOLDIERS_AT_ORIGIN 10
-#define SOLDIERS_TO_WIN 10
 #define MAX_ROCKETS 20 // Máximo de foguetes ativos simultaneamente por todas as baterias
+#define DEFAULT_BATTERIES 2
+#define MAX_BATTERIES 60000 // limite dos contadores da grade de ocupação
+#define MAX_SOLDIERS 65535  // todos começam na célula da origem, num contador de 16 bits da grade
 #define MAX_AMMO_EASY 5
 #define MAX_AMMO_MEDIUM 7
 #define MAX_AMMO_HARD 10
@@ -35,6 +52,24 @@
 #define RECHARGE_TIME_HARD_MAX_MS 2000
 #define BOARDING_INTERVAL_MS 400
 
+// Períodos de atualização de cada ator
+#define HELICOPTER_STEP_MS 100 // também é o intervalo mínimo entre dois movimentos
+#define HELICOPTER_INPUT_QUEUE 4 // teclas pendentes guardadas entre movimentos
+#define BATTERY_STEP_MS 150
+#define ROCKET_STEP_MS 70 // Período padrão do estágio de física dos foguetes
+#define ROCKET_SPEED 0.7f // Células por passo de ROCKET_STEP_MS
+#define RENDER_STEP_MS 50
+#define SIM_TICK_MS 10 // Tick padrão do escalonador (divide todos os períodos acima)
+#define MAX_TICK_MS 1000
+#define SCHED_PARALLEL_MIN 32 // abaixo disso os timers de um tick rodam na thread do relógio
+#define SCHED_MAX_SLEEP_MS 100 // teto de cada espera; o fim de jogo acorda antes (shutdown_fd)
+#define HEADLESS_DEFAULT_TICKS 60000 // 10 minutos simulados
+#define BENCH_DEFAULT_TOLERANCE 15 // --tolerance, em %
+#define HELICOPTER_CAPACITY 10
+#define AUTOPILOT_CRUISE_Y (SCREEN_HEIGHT / 2) // Altitude de cruzeiro: entre a ponte e o chão
+#define REPLAY_VERSION 3
+#define REPLAY_HASH_EVERY 10 // passos do helicóptero entre dois hashes de estado no log
+
 
 // Posições (aproximadas, podem precisar de ajuste)
 #define ORIGIN_X 1
@@ -47,14 +82,47 @@
 #define BRIDGE_START_X 10
 #define BRIDGE_END_X (SCREEN_WIDTH - 10)
 
-#define BATTERY_0_COMBAT_X (BRIDGE_START_X + 5)
-#define BATTERY_0_COMBAT_Y (SCREEN_HEIGHT - 2)
-#define BATTERY_1_COMBAT_X (BRIDGE_END_X - 5)
-#define BATTERY_1_COMBAT_Y (SCREEN_HEIGHT - 2)
+// Faixa onde as posições de combate são distribuídas (B0 e B1 nas pontas)
+#define BATTERY_COMBAT_MIN_X (BRIDGE_START_X + 5)
+#define BATTERY_COMBAT_MAX_X (BRIDGE_END_X - 5)
+#define BATTERY_COMBAT_Y (SCREEN_HEIGHT - 2)
+#define BATTERY_COMBAT_ROWS 5 // fileiras acima do chão antes de empilhar na mesma célula
+#define BRIDGE_MAX_BATCH 4 // entradas seguidas num sentido enquanto o outro espera
+#define DEFAULT_DEPOT_SLOTS 1
+
+// Comandos do helicóptero, independentes do ncurses
+typedef enum { CMD_NONE, CMD_UP, CMD_DOWN, CMD_LEFT, CMD_RIGHT } HeliCommand;
+
+/* Gerador xoshiro128**: um por entidade, sem estado compartilhado. Todos
+   derivam da semente mestra (--seed) por splitmix64, então a mesma semente
+   reproduz a partida bit a bit. */
+typedef struct {
+    uint32_t s[4];
+} Rng;
+
+#define RNG_STREAM_POLICY 0 // política do helicóptero; baterias usam 1 + id
+
+// Roda de temporizadores hierárquica: 4 níveis de 64 slots (64^4 ticks à frente)
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+/* Ordem de despacho dentro do mesmo tick: igual ao laço antigo do headless
+   (foguetes, baterias, helicóptero), o que mantém as partidas determinísticas. */
+typedef enum { TIMER_ROCKETS, TIMER_BATTERY, TIMER_RECHARGE, TIMER_HELICOPTER } TimerKind;
+
+typedef struct Timer {
+    struct Timer* next;
+    uint64_t expires; // tick absoluto
+    TimerKind kind;
+    int id;           // índice da bateria; 0 para os demais
+} Timer;
 
-// Estados
-volatile bool game_running = true;
-int game_difficulty = 1; // 1: Fácil, 2: Médio, 3: Difícil
+typedef struct {
+    Timer* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS]; // bit s = slot s não vazio
+    uint64_t now;                    // próximo tick a processar
+} TimerWheel;
 
 // --- Estruturas de Dados ---
 typedef struct {
@@ -86,21 +154,72 @@ typedef struct {
         B_FINAL_POSITIONING
     } status;
     pthread_mutex_t mutex;
+    Rng rng;               // disparos e duração das recargas desta bateria
     long recharge_min_ms;
     long recharge_max_ms;
+    long recharge_done_ms; // 0 = na fila do depósito (ou fora dele)
+    Timer step_timer;      // passo periódico; fica desarmado durante a recarga
+    Timer recharge_timer;  // fim da recarga
+    bool bridge_granted;   // liberada pelo árbitro enquanto esperava na fila
+    long bridge_wait_since_ms;
+    long depot_wait_since_ms;
+    uint64_t depot_ticket; // ordem de chegada ao depósito (desempate da fila)
+    // Estatísticas (lidas pelo modo batch)
+    int rockets_fired;
+    int recharges;
 } Battery;
 
+/* Foguetes em structure-of-arrays: os campos quentes do passo de física
+   (posição precisa, velocidade e célula) ficam em vetores alinhados a 32
+   bytes, separados dos frios. O bit i de active_mask indica o slot i ativo. */
+typedef struct {
+    float* px;
+    float* py;
+    float* dx;
+    float* dy;
+    int* x;
+    int* y;
+    uint64_t* active_mask;
+
+    int* owner_battery_id;
+    int* free_slots;   // pilha de slots livres
+    int free_top;
+    int limit;         // slots utilizáveis (WorldConfig.rocket_slots)
+    int capacity;      // limit arredondado para múltiplo de 64
+} RocketStore;
+
+// Célula contra a qual o passo dos foguetes testa o segmento percorrido
 typedef struct {
     int x, y;
+} SweepTarget;
 
-    float precise_x, precise_y;
-    
-    float dx, dy;
+/* Grade de ocupação do tamanho do mapa: obstáculos fixos num bitset
+   pré-calculado e, por célula, quantas entidades dinâmicas de cada tipo
+   estão ali. Os contadores são atômicos e atualizados a cada movimento,
+   sob o lock da própria entidade; quem consulta não trava nada.
+   O mapa é dividido em blocos de GRID_CHUNK x GRID_CHUNK alocados na
+   primeira escrita: um mapa de 100k x 100k só ocupa os blocos por onde
+   algo passou. A borda do mapa é obstáculo por conta, sem bits. */
+#define GRID_CHUNK_SHIFT 6
+#define GRID_CHUNK (1 << GRID_CHUNK_SHIFT)
+#define GRID_ACTIVE_RADIUS 2 // blocos ativos em volta do helicóptero (em cada direção)
 
-    bool active;
-    int owner_battery_id; 
-    pthread_t thread_id; 
-} Rocket;
+typedef enum { GRID_BATTERIES, GRID_ROCKETS, GRID_SOLDIERS, GRID_LAYERS } GridLayer;
+
+typedef struct GridChunk {
+    uint64_t static_bits[GRID_CHUNK * GRID_CHUNK / 64];
+    atomic_ushort layers[GRID_LAYERS][GRID_CHUNK * GRID_CHUNK];
+    struct GridChunk* next_alloc; // lista dos blocos alocados, para liberar sem varrer o diretório
+} GridChunk;
+
+typedef struct {
+    int width, height;
+    int chunks_x, chunks_y;
+    _Atomic(GridChunk*)* chunks;  // NULL = bloco vazio, ainda não alocado
+    size_t directory_bytes;
+    _Atomic(GridChunk*) allocated;
+    atomic_int focus_cx, focus_cy; // bloco do helicóptero: centro da área ativa
+} OccupancyGrid;
 
 // Estado global do jogo
 typedef struct {
@@ -115,650 +234,5218 @@ typedef struct {
     bool active;
 } Soldier;
 
-struct timespec ts;
-long last_board_ms = 0;
+// Estatísticas de uma partida (lidas pelo modo batch)
+typedef struct {
+    long end_ms;           // instante lógico do fim do jogo (-1 = em andamento)
+} WorldStats;
 
-// --- Variáveis Globais ---
-Helicopter helicopter;
-Battery batteries[2];
-Rocket active_rockets[MAX_ROCKETS];
-Soldier soldiers[INITIAL_SOLDIERS_AT_ORIGIN];
-GameState game_state;
+// Quem o depósito atende primeiro quando todas as vagas estão ocupadas
+typedef enum { DEPOT_LOWEST_AMMO, DEPOT_LONGEST_WAIT } DepotPolicy;
 
-pthread_mutex_t mutex_ponte;
-pthread_mutex_t mutex_deposito_access; // Para acesso ao local do depósito
-pthread_cond_t cond_deposito_livre;
-bool deposito_ocupado = false;
+// Tamanho do mundo, escolhido em tempo de execução
+typedef struct {
+    int battery_count;
+    int rocket_slots;
+    int soldier_count;     // também é a meta de resgate
+    int tick_ms;           // resolução do escalonador
+    int physics_ms;        // período do passo dos foguetes (velocidade por segundo constante)
+    int depot_slots;       // baterias recarregando ao mesmo tempo
+    DepotPolicy depot_policy;
+    int map_width, map_height; // o cenário fica no canto superior esquerdo
+} WorldConfig;
 
-pthread_mutex_t mutex_rocket_list; // Para proteger o array active_rockets
+// Cópia imutável do mundo publicada pela simulação para os leitores
+typedef struct {
+    int id, x, y;
+    int ammo, max_ammo;
+    int status;
+} BatterySnapshot;
 
-// --- Protótipos das Funções das Threads ---
-void* helicopter_thread_func(void* arg);
-void* battery_thread_func(void* arg); // arg será o ID da bateria (0 ou 1)
-void* rocket_thread_func(void* arg);  // arg será o índice do foguete em active_rockets
-void* game_manager_thread_func(void* arg);
+typedef struct {
+    int x, y;
+} RocketSnapshot;
 
-// --- Funções Auxiliares ---
-void init_game_elements() {
-    // Helicóptero
-    pthread_mutex_init(&helicopter.mutex, NULL);
-    pthread_mutex_lock(&helicopter.mutex);
-    helicopter.x = PLATFORM_X;
-    helicopter.y = PLATFORM_Y;
-    helicopter.soldiers_on_board = 0;
-    helicopter.soldiers_rescued_total = 0;
-    helicopter.status = H_ACTIVE;
-    pthread_mutex_unlock(&helicopter.mutex);
+typedef struct {
+    uint64_t seq;  // número de publicação (cresce a cada snapshot)
+    long clock_ms;
+    int heli_x, heli_y, heli_status;
+    int soldiers_on_board, soldiers_rescued_total;
+    int soldiers_at_origin;
+    int soldiers_to_win;
+    int map_width, map_height;
+    int bridge_queue;
+    bool game_over, victory;
+    int battery_count;
+    BatterySnapshot* batteries;
+    int rocket_count;
+    RocketSnapshot* rockets;
+} WorldSnapshot;
 
-    // Estado do Jogo
-    pthread_mutex_init(&game_state.mutex, NULL);
-    pthread_mutex_lock(&game_state.mutex);
-    game_state.game_over_flag = false;
-    game_state.victory_flag = false;
-    game_state.soldiers_at_origin_count = INITIAL_SOLDIERS_AT_ORIGIN;
-    pthread_mutex_unlock(&game_state.mutex);
+/* Triple buffer de um consumidor: o produtor escreve em 'back' e troca com
+   'middle'; o consumidor troca 'front' com 'middle' se houver novidade.
+   Nenhum dos lados espera o outro. */
+#define SNAPSHOT_FRESH 4u
+#define MAX_SNAPSHOT_CHANNELS 4
+#define HELI_STEPPED 1u // bits de World.heli_pending
+#define HELI_MOVED 2u
+typedef struct {
+    WorldSnapshot bufs[3];
+    unsigned back;        // só o produtor
+    atomic_uint middle;   // índice | SNAPSHOT_FRESH
+    unsigned front;       // só o consumidor
+} SnapshotChannel;
 
-    // Soldados
-    int max_soldier_x = SCREEN_WIDTH/2 - 2;
-    for (int i = 0; i < INITIAL_SOLDIERS_AT_ORIGIN; ++i) {
-        soldiers[i].x      = ORIGIN_X;
-        soldiers[i].y      = ORIGIN_Y;
-        soldiers[i].active = true;
-    }
+/* Anel de snapshots em memória compartilhada (POSIX shm) para leitores de
+   outros processos. Um escritor, qualquer número de leitores, nenhum lock:
+   cada quadro tem um seqlock (ímpar = sendo escrito) e o leitor copia e
+   confere se o número não mudou. Layout, todos os campos em bytes nativos:
+     ShmHeader, depois slot_count quadros de slot_bytes cada um; cada quadro
+     é um ShmFrame seguido de battery_count ShmBattery e rocket_count
+     ShmRocket (a bateria i tem id i).
+   O quadro mais novo é o (published - 1) % slot_count. */
+#define SHM_MAGIC 0x4D534748u // "HGSM" em little-endian
+#define SHM_VERSION 1
+#define SHM_RING_SLOTS 64
 
-    // Baterias
-    int base_ammo;
-    long min_recharge, max_recharge;
+typedef struct {
+    int32_t x, y, ammo, max_ammo, status;
+} ShmBattery;
 
-    if (game_difficulty == 1) { // Fácil
-        base_ammo = MAX_AMMO_EASY;
-        min_recharge = RECHARGE_TIME_EASY_MIN_MS;
-        max_recharge = RECHARGE_TIME_EASY_MAX_MS;
-    } else if (game_difficulty == 2) { // Médio
-        base_ammo = MAX_AMMO_MEDIUM;
-        min_recharge = RECHARGE_TIME_MEDIUM_MIN_MS;
-        max_recharge = RECHARGE_TIME_MEDIUM_MAX_MS;
-    } else { // Difícil
-        base_ammo = MAX_AMMO_HARD;
-        min_recharge = RECHARGE_TIME_HARD_MIN_MS;
-        max_recharge = RECHARGE_TIME_HARD_MAX_MS;
-    }
+typedef struct {
+    int32_t x, y;
+} ShmRocket;
 
+typedef struct {
+    _Atomic uint64_t seq;  // seqlock do quadro
+    uint64_t index;        // número de publicação que ocupa o slot
+    int64_t clock_ms;
+    int32_t heli_x, heli_y, heli_status;
+    int32_t soldiers_on_board, soldiers_rescued_total, soldiers_at_origin, soldiers_to_win;
+    int32_t bridge_queue;
+    int32_t game_over, victory;
+    int32_t battery_count, rocket_count;
+} ShmFrame;
 
-    for (int i = 0; i < 2; i++) {
-        pthread_mutex_init(&batteries[i].mutex, NULL);
-        pthread_mutex_lock(&batteries[i].mutex);
-        batteries[i].id = i;
-        batteries[i].combat_x = (i == 0) ? BATTERY_0_COMBAT_X : BATTERY_1_COMBAT_X;
-        batteries[i].combat_y = (i == 0) ? BATTERY_0_COMBAT_Y : BATTERY_1_COMBAT_Y;
-        batteries[i].x = batteries[i].combat_x;
-        batteries[i].y = batteries[i].combat_y;
-        batteries[i].ammo = base_ammo;
-        batteries[i].max_ammo = base_ammo;
-        batteries[i].status = B_FIRING;
-        batteries[i].recharge_min_ms = min_recharge;
-        batteries[i].recharge_max_ms = max_recharge;
-        pthread_mutex_unlock(&batteries[i].mutex);
-    }
+typedef struct {
+    _Atomic uint32_t magic; // escrito por último: o cabeçalho está pronto
+    uint32_t version;
+    uint32_t slot_count, slot_bytes;
+    int32_t map_width, map_height;
+    int32_t max_batteries, max_rockets;
+    _Atomic uint64_t published; // quadros escritos desde o início
+    atomic_int closed;          // o escritor terminou
+} ShmHeader;
 
-    // Foguetes
-    pthread_mutex_init(&mutex_rocket_list, NULL);
-    pthread_mutex_lock(&mutex_rocket_list);
-    for (int i = 0; i < MAX_ROCKETS; i++) {
-        active_rockets[i].active = false;
-    }
-    pthread_mutex_unlock(&mutex_rocket_list);
+typedef struct {
+    char name[64];
+    ShmHeader* hdr;
+    size_t bytes;
+    WorldSnapshot capture; // área de captura quando não há canal local
+} ShmRing;
 
-    // Recursos Compartilhados
-    pthread_mutex_init(&mutex_ponte, NULL);
-    pthread_mutex_init(&mutex_deposito_access, NULL);
-    pthread_cond_init(&cond_deposito_livre, NULL);
-    deposito_ocupado = false;
-}
+/* Árbitro da ponte: uma fila FIFO por sentido. Baterias no mesmo sentido
+   atravessam juntas; se o outro lado está esperando, no máximo
+   BRIDGE_MAX_BATCH entram antes de o sentido virar (espera limitada).
+   Quem não pode entrar fica na fila com o passo desarmado até ser liberado. */
+typedef enum { BRIDGE_TO_DEPOT, BRIDGE_TO_COMBAT } BridgeDirection;
 
-void cleanup_game_resources() {
-    pthread_mutex_destroy(&helicopter.mutex);
-    for (int i = 0; i < 2; i++) {
-        pthread_mutex_destroy(&batteries[i].mutex);
-    }
-    pthread_mutex_destroy(&mutex_rocket_list);
-    pthread_mutex_destroy(&mutex_ponte);
-    pthread_mutex_destroy(&mutex_deposito_access);
-    pthread_cond_destroy(&cond_deposito_livre);
-    pthread_mutex_destroy(&game_state.mutex);
-}
+typedef struct {
+    pthread_mutex_t mutex;
+    BridgeDirection direction;
+    int on_bridge;        // baterias liberadas e ainda não saíram
+    int batch;            // entradas no sentido atual desde a última virada
+    int* queue[2];        // anéis de ids de bateria, capacidade battery_count
+    int head[2], waiting[2];
+    int capacity;
+    // Estatísticas
+    long crossings;
+    long waits;           // travessias que passaram pela fila
+    long total_wait_ms;
+    long max_wait_ms;
+    int max_queue;
+} BridgeArbiter;
 
-// --- Main ---
-int main() {
-    srand(time(NULL)); // Para aleatoriedade
+/* Depósito com depot_slots vagas. Quem chega sem vaga entra num heap de
+   prioridade (menos munição, depois chegada mais antiga; ou só chegada) e
+   fica parado até uma recarga terminar e o depósito o admitir. */
+typedef struct {
+    pthread_mutex_t mutex;
+    int slots, busy;
+    DepotPolicy policy;
+    int* heap;            // ids de bateria
+    int waiting;
+    uint64_t next_ticket;
+    // Estatísticas
+    long admissions;
+    long waits;
+    long total_wait_ms;
+    long max_wait_ms;
+    int max_queue;
+} Depot;
 
-    // Inicialização do Ncurses
-    initscr();
-    cbreak();
-    noecho();
-    curs_set(0); // Esconde o cursor
-    keypad(stdscr, TRUE); // Permite uso de setas
-    nodelay(stdscr, TRUE); // getch() não bloqueante
+/* Caixa de comandos do modo ator: fila MPSC intrusiva de Vyukov. Qualquer
+   thread empilha com uma troca atômica; só a thread dona do mundo consome.
+   O nó 'stub' mantém a fila nunca vazia, sem alocação no caminho comum. */
+typedef enum { SIM_HELI_INPUT } SimCommandKind;
 
-    mvprintw(SCREEN_HEIGHT / 2 - 2, SCREEN_WIDTH / 2 - 15, "Escolha a dificuldade:");
-    mvprintw(SCREEN_HEIGHT / 2 - 0, SCREEN_WIDTH / 2 - 15, "1: Facil");
-    mvprintw(SCREEN_HEIGHT / 2 + 1, SCREEN_WIDTH / 2 - 15, "2: Medio");
-    mvprintw(SCREEN_HEIGHT / 2 + 2, SCREEN_WIDTH / 2 - 15, "3: Dificil");
-    refresh();
+typedef struct SimCommand {
+    _Atomic(struct SimCommand*) next;
+    SimCommandKind kind;
+    int arg;
+} SimCommand;
 
-    int choice = 0;
-    nodelay(stdscr, FALSE); // Bloqueante para escolha
-    while(choice < '1' || choice > '3') {
-        choice = getch();
-    }
-    game_difficulty = choice - '0';
-    nodelay(stdscr, TRUE); // Volta para não bloqueante
-    clear();
-    refresh();
+typedef struct {
+    _Atomic(SimCommand*) head;  // produtores
+    SimCommand* tail;           // consumidor
+    SimCommand stub;
+} CommandQueue;
+
+/* Contexto de uma partida: todo o estado que antes era global. Cada World é
+   independente (locks próprios, RNG próprio), então várias partidas podem
+   rodar lado a lado no mesmo processo. */
+typedef struct {
+    volatile bool running;
+    int shutdown_fd; // eventfd escrito no fim de jogo; toda espera faz poll nele (-1 no headless)
+    int difficulty; // 1: Fácil, 2: Médio, 3: Difícil
+    WorldConfig config;
+
+    // Relógio: no modo headless o tempo é lógico (ticks * tick_ms), sem usleep
+    bool headless;
+    bool deterministic; // interativo gravando/reproduzindo: relógio lógico e despacho em ordem
+    long clock_ms;
+
+    // Escalonador: todos os passos periódicos e fins de recarga são timers
+    TimerWheel timers;
+    pthread_mutex_t timer_mutex; // armar timers a partir de vários workers
+    long timer_epoch_ms;         // instante do tick 0 (0 no headless)
+    Timer rockets_timer;
+    Timer helicopter_timer;      // headless e modo determinístico; senão o passo segue o teclado
+    Timer** due;                 // timers vencidos no tick corrente, em ordem de despacho
+    int due_count, due_cap;
+
+    OccupancyGrid grid;
+    Helicopter helicopter;
+    Battery* batteries;   // pool de config.battery_count, alocado uma vez em init
+    RocketStore rockets;
+    Soldier* soldiers;    // pool de config.soldier_count
+    GameState game_state;
+    long last_board_ms;
+
+    BridgeArbiter bridge;
+    Depot depot;
+
+    pthread_mutex_t mutex_rocket_list; // Para proteger o RocketStore rockets
+
+    uint64_t seed; // semente mestra; cada entidade deriva o próprio Rng dela
+    WorldStats stats;
+
+    // Publicação de snapshots: o mutex só serializa os produtores (simulação)
+    pthread_mutex_t snapshot_mutex;
+    uint64_t snapshot_seq;
+    SnapshotChannel* snapshot_channels[MAX_SNAPSHOT_CHANNELS];
+    int snapshot_channel_count;
+    ShmRing* shm; // --publish
+    /* Passos da thread do helicóptero ainda sem quadro: HELI_STEPPED e, se
+       ele andou, HELI_MOVED. Quem publica é o escalonador, entre ticks. */
+    atomic_uint heli_pending;
+
+    // Acorda o renderizador antes do fim do período (ex.: movimento do jogador)
+    pthread_mutex_t render_mutex;
+    pthread_cond_t render_cond; // usa CLOCK_MONOTONIC
+    bool render_kicked;
+    _Atomic uint64_t presented_heli; // (x << 32 | y) do helicóptero no último quadro emitido (--bench)
+
+    // Modo determinístico: teclas esperam aqui pelo timer do helicóptero
+    pthread_mutex_t input_mutex;
+    HeliCommand input_queue[HELICOPTER_INPUT_QUEUE];
+    int input_count;
+
+    // Modo ator: só a thread do escalonador muda o estado; o resto envia comandos
+    bool actor;
+    CommandQueue commands;
+} World;
+
+/* Relógio do modo interativo: uma thread dorme até o próximo timer e
+   reparte os timers vencidos com um conjunto fixo de workers (roubo de
+   trabalho por faixas, ver scheduler_parallel_for). Com uma
+   política (gravação/replay) o helicóptero também vira timer e tudo roda
+   em ordem na thread do relógio. No modo ator essa thread é a única que
+   muda o mundo: não usa workers, não trava os locks do jogo e recebe o
+   teclado pela caixa de comandos. */
+struct HeliPolicy;
+
+struct Scheduler;
+typedef void (*RangeFn)(struct Scheduler* s, int worker, int lo, int hi);
+
+/* Faixa [lo, hi) de um worker no parallel-for, num só atômico (lo nos 32
+   bits baixos) para que dono e ladrão disputem com um CAS. Uma linha de
+   cache por worker. */
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} WorkerRange;
+
+typedef struct {
+    int* culled;   // foguetes que saíram da área neste tick (fase de colisão)
+    int culled_count;
+    int hit;       // foguete que acertou o helicóptero, ou -1
+} WorkerScratch;
+
+typedef struct Scheduler {
+    World* world;
+    struct HeliPolicy* policy; // NULL = helicóptero guiado pela thread de teclado
+    bool single_writer;    // modo ator: tudo nesta thread, locks do jogo elididos
+    bool unpaced;          // sem esperar o relógio de parede (benchmark)
+    uint64_t tick_limit;   // para ao chegar neste tick (UINT64_MAX = sem limite)
+    long timers_fired;
+    int worker_count;
+    pthread_t* workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;  // nova rodada de timers
+    pthread_cond_t done;   // todos os workers terminaram a rodada
+    uint64_t round;
+    int busy;
+    bool stop;
+    // parallel-for da rodada corrente; índice 0 é a própria thread do relógio
+    RangeFn job_fn;
+    int job_chunk;
+    int job_first;          // fase de simulação: primeiro timer de w->due
+    const SweepTarget* sweep; // fase de colisão: helicóptero (NULL = não é alvo)
+    WorkerRange* ranges;    // worker_count + 1
+    WorkerScratch* scratch; // worker_count + 1
+    atomic_int next_index;
+} Scheduler;
+
+bool scheduler_start(Scheduler* s, World* w, int worker_count, struct HeliPolicy* policy);
+void scheduler_stop(Scheduler* s);
+
+typedef enum { RENDER_CURSES, RENDER_ANSI } RenderBackend;
+
+typedef struct {
+    World* world;
+    SnapshotChannel* channel;
+    RenderBackend backend;
+    int out_fd; // destino da saída ANSI (o --bench descarta em /dev/null)
+} RenderThreadArg;
 
+// --- Protótipos das Funções das Threads ---
+void* helicopter_thread_func(void* arg);     // arg é o World*
+void* keyboard_thread_func(void* arg);       // arg é o World*; só no modo determinístico
+void* scheduler_thread_func(void* arg);      // arg é um Scheduler*; dispara baterias e foguetes
+void* game_manager_thread_func(void* arg);  // arg é um RenderThreadArg*
+
+// --- Passos da simulação (compartilhados pelas threads e pelo modo headless) ---
+bool helicopter_step(World* w, HeliCommand cmd);
+bool battery_step(World* w, Battery* self);
+void battery_finish_recharge(World* w, Battery* self);
+void depot_request(World* w, Battery* b);
+void depot_release(World* w);
+void rockets_step(World* w);
+
+// --- Instrumentação de locks (--lock-stats) ---
+/* GAME_LOCK/GAME_UNLOCK substituem pthread_mutex_lock/unlock nos locks do
+   jogo. Desligado, é só um desvio a mais. Ligado, cada ponto de chamada
+   tem um LockSite estático com contagem, contenção (trylock falhou) e
+   histogramas log2 (ns) de espera e de posse; a posse é medida por uma
+   pilha por thread dos locks em mãos. Os locks usados com variáveis de
+   condição (escalonador, renderizador) ficam de fora. */
+#define LOCK_HIST_BUCKETS 40
+#define LOCK_MAX_HELD 16
+
+typedef struct LockSite {
+    const char* name;  // expressão do lock no código
+    int line;
+    atomic_ulong acquisitions;
+    atomic_ulong contended;
+    atomic_ulong wait_ns, hold_ns;
+    atomic_ulong wait_hist[LOCK_HIST_BUCKETS];
+    atomic_ulong hold_hist[LOCK_HIST_BUCKETS];
+    atomic_bool registered;
+    struct LockSite* next;
+} LockSite;
+
+typedef struct {
+    pthread_mutex_t* mutex;
+    LockSite* site;
+    uint64_t acquired_ns;
+} HeldLock;
+
+static bool lock_stats_enabled;
+static _Atomic(LockSite*) lock_sites;
+static _Thread_local bool lock_elided; // dona única do mundo (modo ator): sem locks
+static _Thread_local HeldLock lock_held[LOCK_MAX_HELD];
+static _Thread_local int lock_held_count;
+
+#define GAME_LOCK(m) do { \
+        static LockSite lock_site_ = { .name = #m, .line = __LINE__ }; \
+        lock_stats_lock(&lock_site_, (m)); \
+    } while (0)
+#define GAME_UNLOCK(m) lock_stats_unlock(m)
 
-    init_game_elements();
+static inline uint64_t lock_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
 
-    pthread_t tid_helicopter, tid_battery0, tid_battery1, tid_game_manager;
-    int battery_ids[2] = {0, 1};
+static inline int lock_bucket(uint64_t ns) {
+    int b = ns ? 64 - __builtin_clzll(ns) : 0; // bucket b: [2^(b-1), 2^b)
+    return b < LOCK_HIST_BUCKETS ? b : LOCK_HIST_BUCKETS - 1;
+}
 
-    // Criação das threads
-    if (pthread_create(&tid_helicopter, NULL, helicopter_thread_func, NULL) != 0) {
-        perror("Failed to create helicopter thread"); return 1;
+void lock_stats_lock(LockSite* site, pthread_mutex_t* m) {
+    if (lock_elided) return;
+    if (!lock_stats_enabled) {
+        pthread_mutex_lock(m);
+        return;
     }
-    if (pthread_create(&tid_battery0, NULL, battery_thread_func, &battery_ids[0]) != 0) {
-        perror("Failed to create battery 0 thread"); return 1;
+    if (!atomic_exchange(&site->registered, true)) {
+        site->next = atomic_load(&lock_sites);
+        while (!atomic_compare_exchange_weak(&lock_sites, &site->next, site)) {}
     }
-    if (pthread_create(&tid_battery1, NULL, battery_thread_func, &battery_ids[1]) != 0) {
-        perror("Failed to create battery 1 thread"); return 1;
+    uint64_t t0 = lock_now_ns();
+    if (pthread_mutex_trylock(m) != 0) {
+        atomic_fetch_add_explicit(&site->contended, 1, memory_order_relaxed);
+        pthread_mutex_lock(m);
     }
-    if (pthread_create(&tid_game_manager, NULL, game_manager_thread_func, NULL) != 0) {
-        perror("Failed to create game manager thread"); return 1;
+    uint64_t t1 = lock_now_ns();
+    atomic_fetch_add_explicit(&site->acquisitions, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->wait_ns, t1 - t0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->wait_hist[lock_bucket(t1 - t0)], 1, memory_order_relaxed);
+    if (lock_held_count < LOCK_MAX_HELD) {
+        lock_held[lock_held_count++] = (HeldLock){ m, site, t1 };
     }
+}
 
-    // Aguarda finalização das threads persistentes
-    pthread_join(tid_helicopter, NULL);
-    pthread_join(tid_battery0, NULL);
-    pthread_join(tid_battery1, NULL);
-    pthread_join(tid_game_manager, NULL);
-    
-    // Limpeza
-    cleanup_game_resources();
-    clear();
-    mvprintw(SCREEN_HEIGHT / 2 - 1, SCREEN_WIDTH / 2 - 10, "FIM DE JOGO!");
-    pthread_mutex_lock(&game_state.mutex);
-    if (game_state.victory_flag) {
-        mvprintw(SCREEN_HEIGHT / 2 + 1, SCREEN_WIDTH / 2 - 10, "VOCE VENCEU!");
-    } else {
-        mvprintw(SCREEN_HEIGHT / 2 + 1, SCREEN_WIDTH / 2 - 10, "VOCE PERDEU!");
+void lock_stats_unlock(pthread_mutex_t* m) {
+    if (lock_elided) return;
+    if (lock_stats_enabled) {
+        for (int i = lock_held_count - 1; i >= 0; i--) {
+            if (lock_held[i].mutex != m) continue;
+            uint64_t held = lock_now_ns() - lock_held[i].acquired_ns;
+            LockSite* site = lock_held[i].site;
+            atomic_fetch_add_explicit(&site->hold_ns, held, memory_order_relaxed);
+            atomic_fetch_add_explicit(&site->hold_hist[lock_bucket(held)], 1, memory_order_relaxed);
+            lock_held[i] = lock_held[--lock_held_count];
+            break;
+        }
     }
-    pthread_mutex_unlock(&game_state.mutex);
-    refresh();
-    nodelay(stdscr, FALSE); // Bloqueante para ver a msg final
-    getch();
-    endwin();
+    pthread_mutex_unlock(m);
+}
+
+/* Limite superior (ns) do bucket onde cai o percentil q. */
+static uint64_t lock_hist_percentile(atomic_ulong* hist, unsigned long total, double q) {
+    unsigned long target = (unsigned long)(q * total), seen = 0;
+    for (int b = 0; b < LOCK_HIST_BUCKETS; b++) {
+        seen += atomic_load_explicit(&hist[b], memory_order_relaxed);
+        if (seen > target) return b ? 1ULL << b : 1;
+    }
+    return 1ULL << (LOCK_HIST_BUCKETS - 1);
+}
 
-    printf("Jogo encerrado.\n");
-    pthread_mutex_lock(&game_state.mutex);
-    if(game_state.victory_flag) printf("Resultado: VITORIA!\n"); else printf("Resultado: DERROTA!\n");
-    pthread_mutex_unlock(&game_state.mutex);
-    printf("Soldados resgatados: %d\n", helicopter.soldiers_rescued_total);
+static int lock_site_by_wait(const void* a, const void* b) {
+    unsigned long wa = atomic_load(&(*(LockSite* const*)a)->wait_ns);
+    unsigned long wb = atomic_load(&(*(LockSite* const*)b)->wait_ns);
+    return (wa < wb) - (wa > wb);
+}
 
+/* Tabela por ponto de chamada, da maior espera total para a menor. */
+void lock_stats_dump(FILE* f) {
+    if (!lock_stats_enabled) return;
+    int n = 0;
+    for (LockSite* s = atomic_load(&lock_sites); s; s = s->next) n++;
+    LockSite** sites = calloc(n ? n : 1, sizeof(LockSite*));
+    if (!sites) { perror("calloc"); return; }
+    n = 0;
+    for (LockSite* s = atomic_load(&lock_sites); s; s = s->next) sites[n++] = s;
+    qsort(sites, n, sizeof(LockSite*), lock_site_by_wait);
 
-    return 0;
+    fprintf(f, "%-32s %5s %10s %6s %10s %10s %10s %10s\n", "lock", "linha", "aquisicoes",
+            "cont%", "espera us", "esp p99", "posse us", "posse p99");
+    for (int i = 0; i < n; i++) {
+        LockSite* s = sites[i];
+        unsigned long acq = atomic_load(&s->acquisitions);
+        if (acq == 0) continue;
+        fprintf(f, "%-32s %5d %10lu %6.1f %10.2f %10.2f %10.2f %10.2f\n", s->name, s->line, acq,
+                100.0 * atomic_load(&s->contended) / acq,
+                atomic_load(&s->wait_ns) / 1000.0 / acq,
+                lock_hist_percentile(s->wait_hist, acq, 0.99) / 1000.0,
+                atomic_load(&s->hold_ns) / 1000.0 / acq,
+                lock_hist_percentile(s->hold_hist, acq, 0.99) / 1000.0);
+    }
+    free(sites);
 }
 
-// --- Implementação das Threads ---
+/* Uma linha para o HUD de depuração: o ponto com mais espera acumulada. */
+void lock_stats_hud(char* buf, size_t len) {
+    LockSite* worst = NULL;
+    for (LockSite* s = atomic_load(&lock_sites); s; s = s->next) {
+        if (!worst || atomic_load(&s->wait_ns) > atomic_load(&worst->wait_ns)) worst = s;
+    }
+    unsigned long acq = worst ? atomic_load(&worst->acquisitions) : 0;
+    if (!acq) {
+        snprintf(buf, len, "LOCKS: sem dados");
+        return;
+    }
+    snprintf(buf, len, "LOCK %s:%d cont %.0f%% esp %.1fus posse %.1fus", worst->name, worst->line,
+             100.0 * atomic_load(&worst->contended) / acq,
+             atomic_load(&worst->wait_ns) / 1000.0 / acq, atomic_load(&worst->hold_ns) / 1000.0 / acq);
+}
 
-void* helicopter_thread_func(void* arg) {
-    int input;
-    while (game_running) {
-        input = getch(); // Non-blocking
+// --- Trace de linha do tempo (--trace ARQ) ---
+/* Grava um JSON no formato Chrome trace (abre no Perfetto ou em
+   chrome://tracing). Cada thread escreve num anel SPSC próprio, sem locks;
+   uma thread de descarga esvazia os anéis e formata o JSON fora do caminho
+   da simulação. Anel cheio descarta o evento e conta, para não distorcer o
+   tempo de quem está sendo medido. */
+#define TRACE_RING_SIZE 16384   // eventos por thread (potência de 2)
+#define TRACE_FLUSH_MS 10
 
-        pthread_mutex_lock(&helicopter.mutex);
-        if (helicopter.status == H_EXPLODED) { // Se explodiu por outra causa (foguete, etc)
-            pthread_mutex_unlock(&helicopter.mutex);
-            break;
-        }
+typedef struct {
+    uint64_t ts_ns, dur_ns;
+    const char* cat;
+    const char* name;
+    const char* arg_name;   // NULL = sem args
+    long arg;
+    int id;                 // eventos assíncronos (b/e): a bateria
+    char ph;                // X, i, b, e
+} TraceEvent;
 
-        // Movimentação
-        switch (input) {
-            case KEY_UP:    helicopter.y--;  flushinp(); break;
-            case KEY_DOWN:  helicopter.y++;  flushinp(); break;
-            case KEY_LEFT:  helicopter.x--;  flushinp(); break;
-            case KEY_RIGHT: helicopter.x++;  flushinp(); break;
-            default: /* nada */;
-        }
+typedef struct TraceRing {
+    TraceEvent events[TRACE_RING_SIZE];
+    atomic_uint head, tail;  // head: só a thread dona; tail: só a descarga
+    atomic_ulong dropped;
+    int tid;
+    char thread_name[32];
+    struct TraceRing* next;
+} TraceRing;
 
-        // Limites da tela
-        if (helicopter.x < 0)                 helicopter.x = 0;
-        if (helicopter.x >  SCREEN_WIDTH - 1) helicopter.x = SCREEN_WIDTH - 1;
-        if (helicopter.y < 0)                 helicopter.y = 0;
-        if (helicopter.y >  SCREEN_HEIGHT - 1)helicopter.y = SCREEN_HEIGHT - 1;
-        
-        // Colisão com o topo (borda)
-        if (helicopter.x == 0 || helicopter.x == SCREEN_WIDTH  - 1 ||
-            helicopter.y == 0 || helicopter.y == SCREEN_HEIGHT - 1) {
-
-            helicopter.status = H_EXPLODED;
-            pthread_mutex_lock(&game_state.mutex);
-            game_state.game_over_flag = true;
-            game_running = false;
-            pthread_mutex_unlock(&game_state.mutex);
-            pthread_mutex_unlock(&helicopter.mutex);
-            break;                          /* sai do loop da thread   */
-        }
-
-        // Colisão com chão/plataforma/depósito/baterias (obstáculos fixos)
-        if (helicopter.y == PLATFORM_Y && helicopter.x == PLATFORM_X) { /* Não explode na plataforma */ }
-        else if (helicopter.y == ORIGIN_Y && helicopter.x == ORIGIN_X) { /* Não explode na origem */ }
-        else if (helicopter.y == DEPOT_Y && helicopter.x == DEPOT_X) {
-            helicopter.status = H_EXPLODED;
-            pthread_mutex_lock(&game_state.mutex);
-            game_state.game_over_flag = true;
-            game_running = false;
-            pthread_mutex_unlock(&game_state.mutex);
-            pthread_mutex_unlock(&helicopter.mutex);
-            break; 
-        }
-        else if (helicopter.y >= SCREEN_HEIGHT - 1) { // Chão genérico
-            helicopter.status = H_EXPLODED;
-             pthread_mutex_lock(&game_state.mutex);
-            game_state.game_over_flag = true;
-            game_running = false;
-            pthread_mutex_unlock(&game_state.mutex);
-            pthread_mutex_unlock(&helicopter.mutex);
-            break;
-        }
+static bool trace_enabled;
+static struct {
+    FILE* out;
+    uint64_t epoch_ns;
+    _Atomic(TraceRing*) rings;
+    atomic_int next_tid;
+    atomic_bool stop;
+    pthread_t flusher;
+    bool first;
+} tracer;
+static _Thread_local TraceRing* trace_ring;
 
-        //colisão com a ponte
-        else if (helicopter.y == BRIDGE_Y_LEVEL && helicopter.x >= BRIDGE_START_X && helicopter.x <= BRIDGE_END_X) {
-            helicopter.status = H_EXPLODED;
-            pthread_mutex_lock(&game_state.mutex);
-            game_state.game_over_flag = true;
-            game_running = false;
-            pthread_mutex_unlock(&game_state.mutex);
-            pthread_mutex_unlock(&helicopter.mutex);
-            break; 
-        }
-
-        for(int i=0; i<2; ++i) {
-            pthread_mutex_lock(&batteries[i].mutex);
-            if (helicopter.x == batteries[i].x && helicopter.y == batteries[i].y) {
-                helicopter.status = H_EXPLODED;
-                pthread_mutex_lock(&game_state.mutex);
-                game_state.game_over_flag = true;
-                game_running = false;
-                pthread_mutex_unlock(&game_state.mutex);
-                pthread_mutex_unlock(&batteries[i].mutex);
-                pthread_mutex_unlock(&helicopter.mutex);
-                goto end_helicopter_loop; // Sai dos loops e da função
-            }
-            pthread_mutex_unlock(&batteries[i].mutex);
-        }
+static const char* const battery_state_names[] = {
+    "B_FIRING", "B_REQUESTING_BRIDGE_TO_DEPOT", "B_MOVING_TO_BRIDGE", "B_ON_BRIDGE_TO_DEPOT",
+    "B_MOVING_TO_DEPOT", "B_RECHARGING", "B_MOVING_FROM_DEPOT", "B_REQUESTING_BRIDGE_TO_COMBAT",
+    "B_ON_BRIDGE_FROM_DEPOT", "B_RETURNING_TO_COMBAT", "B_FINAL_POSITIONING",
+};
+
+static TraceRing* trace_thread_ring(void) {
+    if (trace_ring) return trace_ring;
+    TraceRing* r = calloc(1, sizeof(TraceRing));
+    if (!r) return NULL;
+    r->tid = atomic_fetch_add(&tracer.next_tid, 1);
+    snprintf(r->thread_name, sizeof r->thread_name, "thread %d", r->tid);
+    r->next = atomic_load(&tracer.rings);
+    while (!atomic_compare_exchange_weak(&tracer.rings, &r->next, r)) {}
+    trace_ring = r;
+    return r;
+}
 
+/* Nome exibido na trilha da thread atual. */
+void trace_thread_name(const char* name) {
+    if (!trace_enabled) return;
+    TraceRing* r = trace_thread_ring();
+    if (r) snprintf(r->thread_name, sizeof r->thread_name, "%s", name);
+}
 
-        // Lógica de Soldados
-        pthread_mutex_lock(&game_state.mutex);
-        clock_gettime(CLOCK_MONOTONIC, &ts);
-        long now_ms = ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+static void trace_push(TraceEvent ev) {
+    TraceRing* r = trace_thread_ring();
+    if (!r) return;
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == TRACE_RING_SIZE) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    r->events[head & (TRACE_RING_SIZE - 1)] = ev;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
 
-        for (int i = 0; i < INITIAL_SOLDIERS_AT_ORIGIN; ++i) {
-            if (soldiers[i].active &&
-                helicopter.x == soldiers[i].x &&
-                helicopter.y == soldiers[i].y &&
-                helicopter.soldiers_on_board < 10 &&
-                now_ms - last_board_ms >= BOARDING_INTERVAL_MS) {
+static inline uint64_t trace_begin(void) {
+    return trace_enabled ? lock_now_ns() : 0;
+}
 
-                soldiers[i].active = false;
-                helicopter.soldiers_on_board++;
-                game_state.soldiers_at_origin_count--;
-                last_board_ms = now_ms;          /* reinicia cronômetro */
-                break;
-            }
-        } 
-        if (helicopter.x == PLATFORM_X && helicopter.y == PLATFORM_Y && helicopter.soldiers_on_board > 0) {
-            helicopter.soldiers_rescued_total += helicopter.soldiers_on_board;
-            helicopter.soldiers_on_board = 0;
-            if (helicopter.soldiers_rescued_total >= SOLDIERS_TO_WIN) {
-                helicopter.status = H_MISSION_COMPLETE;
-                game_state.game_over_flag = true;
-                game_state.victory_flag = true;
-                game_running = false;
-            }
-        }
-        pthread_mutex_unlock(&game_state.mutex);
+/* Intervalo da thread atual, de start (trace_begin) até agora. */
+static inline void trace_span(const char* cat, const char* name, uint64_t start,
+                              const char* arg_name, long arg) {
+    if (!trace_enabled) return;
+    trace_push((TraceEvent){ .ts_ns = start, .dur_ns = lock_now_ns() - start, .cat = cat,
+                             .name = name, .arg_name = arg_name, .arg = arg, .ph = 'X' });
+}
 
+static inline void trace_instant(const char* cat, const char* name, const char* arg_name, long arg) {
+    if (!trace_enabled) return;
+    trace_push((TraceEvent){ .ts_ns = lock_now_ns(), .cat = cat, .name = name,
+                             .arg_name = arg_name, .arg = arg, .ph = 'i' });
+}
 
-        // Detecção de colisão com foguetes
-        pthread_mutex_lock(&mutex_rocket_list);
-        for (int i = 0; i < MAX_ROCKETS; i++) {
-            if (active_rockets[i].active && active_rockets[i].x == helicopter.x && active_rockets[i].y == helicopter.y) {
-                helicopter.status = H_EXPLODED;
-                active_rockets[i].active = false; // Foguete some
-                pthread_mutex_lock(&game_state.mutex);
-                game_state.game_over_flag = true;
-                game_running = false;
-                pthread_mutex_unlock(&game_state.mutex);
-                break; 
-            }
-        }
-        pthread_mutex_unlock(&mutex_rocket_list);
+/* Início (ph 'b') ou fim ('e') de um intervalo assíncrono da bateria id. */
+static inline void trace_async(char ph, const char* cat, const char* name, int id) {
+    if (!trace_enabled) return;
+    trace_push((TraceEvent){ .ts_ns = lock_now_ns(), .cat = cat, .name = name, .id = id, .ph = ph });
+}
 
-        bool should_break = false;
-        pthread_mutex_lock(&game_state.mutex);
-        if(game_state.game_over_flag) should_break = true;
-        pthread_mutex_unlock(&game_state.mutex);
+static inline void trace_battery_state(int id, int from, int to) {
+    if (!trace_enabled || from == to) return;
+    trace_async('e', "bateria", battery_state_names[from], id);
+    trace_async('b', "bateria", battery_state_names[to], id);
+}
 
+static void trace_write_event(const TraceRing* r, const TraceEvent* ev) {
+    FILE* f = tracer.out;
+    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+            tracer.first ? "" : ",", ev->name, ev->cat, ev->ph,
+            (ev->ts_ns - tracer.epoch_ns) / 1000.0, r->tid);
+    tracer.first = false;
+    if (ev->ph == 'X') fprintf(f, ",\"dur\":%.3f", ev->dur_ns / 1000.0);
+    if (ev->ph == 'i') fputs(",\"s\":\"t\"", f);
+    if (ev->ph == 'b' || ev->ph == 'e') fprintf(f, ",\"id\":%d", ev->id);
+    if (ev->arg_name) fprintf(f, ",\"args\":{\"%s\":%ld}", ev->arg_name, ev->arg);
+    fputc('}', f);
+}
 
-        pthread_mutex_unlock(&helicopter.mutex);
-        if(should_break) break;
+static void trace_drain(void) {
+    for (TraceRing* r = atomic_load(&tracer.rings); r; r = r->next) {
+        unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+        for (; tail != head; tail++) trace_write_event(r, &r->events[tail & (TRACE_RING_SIZE - 1)]);
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+    }
+}
 
-        usleep(100000); 
+static void* trace_flusher_func(void* arg) {
+    (void)arg;
+    while (!atomic_load(&tracer.stop)) {
+        trace_drain();
+        usleep(TRACE_FLUSH_MS * 1000);
     }
-end_helicopter_loop:
     return NULL;
 }
 
-void* battery_thread_func(void* arg) {
-    int battery_id = *((int*)arg);
-    Battery* self = &batteries[battery_id];
-    int rocket_idx_args[MAX_ROCKETS]; 
-    for(int i=0; i<MAX_ROCKETS; ++i) rocket_idx_args[i] = i;
+bool trace_start(const char* path) {
+    tracer.out = fopen(path, "w");
+    if (!tracer.out) { perror(path); return false; }
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", tracer.out);
+    tracer.first = true;
+    tracer.epoch_ns = lock_now_ns();
+    atomic_init(&tracer.next_tid, 1);
+    atomic_init(&tracer.stop, false);
+    if (pthread_create(&tracer.flusher, NULL, trace_flusher_func, NULL) != 0) {
+        perror("Failed to create trace flusher");
+        fclose(tracer.out);
+        return false;
+    }
+    trace_enabled = true;
+    return true;
+}
 
-    while (game_running) {
-        pthread_mutex_lock(&self->mutex);
-        int target_x; // Variável para o destino horizontal
+/* Para a descarga, esvazia o que sobrou e fecha o JSON com os nomes das
+   threads. Chamar depois que as threads do jogo terminaram. */
+void trace_stop(void) {
+    if (!trace_enabled) return;
+    trace_enabled = false;
+    atomic_store(&tracer.stop, true);
+    pthread_join(tracer.flusher, NULL);
+    trace_drain();
+    unsigned long dropped = 0;
+    TraceRing* r = atomic_load(&tracer.rings);
+    while (r) {
+        fprintf(tracer.out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", tracer.first ? "" : ",", r->tid, r->thread_name);
+        tracer.first = false;
+        dropped += atomic_load(&r->dropped);
+        TraceRing* next = r->next;
+        free(r);
+        r = next;
+    }
+    fputs("\n]}\n", tracer.out);
+    if (fclose(tracer.out) != 0) perror("trace");
+    if (dropped) fprintf(stderr, "Trace: %lu eventos descartados (anel cheio)\n", dropped);
+}
 
-        switch (self->status) {
-            case B_FIRING:
-                if (self->ammo <= 0) {
-                    self->status = B_REQUESTING_BRIDGE_TO_DEPOT;
-                } else {
-                    if (rand() % 20 == 0) { 
-                        int helicopter_x, helicopter_y;
-                        pthread_mutex_lock(&helicopter.mutex);
-                        helicopter_x = helicopter.x;
-                        helicopter_y = helicopter.y;
-                        pthread_mutex_unlock(&helicopter.mutex);
-
-                        float vector_x = helicopter_x - self->x;
-                        float vector_y = helicopter_y - self->y;
-
-                        float length = sqrt(vector_x * vector_x + vector_y * vector_y);
-                        float normalized_dx = 0, normalized_dy = -1; 
-                        if (length > 0) {
-                            normalized_dx = vector_x / length;
-                            normalized_dy = vector_y / length;
-                        }
-                        float rocket_speed = 0.7f; 
-                        
-                        pthread_mutex_lock(&mutex_rocket_list);
-                        for (int i = 0; i < MAX_ROCKETS; i++) {
-                            if (!active_rockets[i].active) {
-                                active_rockets[i].active = true;
-                                active_rockets[i].x = self->x;
-                                active_rockets[i].y = self->y - 1;
-                                active_rockets[i].precise_x = self->x;
-                                active_rockets[i].precise_y = self->y - 1;
-                                active_rockets[i].dx = normalized_dx * rocket_speed;
-                                active_rockets[i].dy = normalized_dy * rocket_speed;
-                                active_rockets[i].owner_battery_id = self->id;
-
-                                pthread_create(&active_rockets[i].thread_id, NULL, rocket_thread_func, &rocket_idx_args[i]);
-                                pthread_detach(active_rockets[i].thread_id);
-
-                                self->ammo--;
-                                break;
-                            }
-                        }
-                        pthread_mutex_unlock(&mutex_rocket_list);
-                    }
-                }
-                break;
+// --- Gerador pseudoaleatório ---
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
 
-            // --- FASE 1: IDA PARA O DEPÓSITO ---
-            case B_REQUESTING_BRIDGE_TO_DEPOT:
-                /* apenas muda de estado; sem lock ainda */
-                self->status = B_MOVING_TO_BRIDGE;
-                break;
+/* Semeia o fluxo 'stream' da semente mestra. */
+void rng_seed(Rng* r, uint64_t master, uint64_t stream) {
+    uint64_t x = master ^ (stream * 0xd1342543de82ef95ULL);
+    uint64_t a = splitmix64(&x), b = splitmix64(&x);
+    r->s[0] = (uint32_t)a;
+    r->s[1] = (uint32_t)(a >> 32);
+    r->s[2] = (uint32_t)b;
+    r->s[3] = (uint32_t)(b >> 32);
+    if (!(r->s[0] | r->s[1] | r->s[2] | r->s[3])) r->s[0] = 1; // estado nulo é ponto fixo
+}
 
-            case B_MOVING_TO_BRIDGE: {
-                const int entry_x = BRIDGE_END_X;   /* já alinhamos B0 e B1 p/ direita */
+static inline uint32_t rng_rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
 
-                /* 1. Caminha até a cabeceira ----------------------------- */
-                if (self->x != entry_x) {
-                    self->x += (self->x < entry_x) ? 1 : -1;
+static inline uint32_t rng_next(Rng* r) {
+    uint32_t* s = r->s;
+    uint32_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 11);
+    return result;
+}
 
-                } else if (self->y > BRIDGE_Y_LEVEL) {
-                    self->y--;
+/* Inteiro uniforme em [0, n) sem divisão (multiplica e desloca). */
+static inline uint32_t rng_below(Rng* r, uint32_t n) {
+    return (uint32_t)(((uint64_t)rng_next(r) * n) >> 32);
+}
 
-                /* 2. Na cabeceira: tentar lock --------------------------- */
-                } else {
-                    /* estamos em (entry_x, BRIDGE_Y_LEVEL) */
-                    if (pthread_mutex_trylock(&mutex_ponte) == 0) {
-                        /*  ponte livre – entra */
-                        self->status = B_ON_BRIDGE_TO_DEPOT;
-                    }
-                    /*  ponte ocupada – fica parado aqui até a próxima iteração */
-                }
-                break;
-            }
+// --- Fila de comandos MPSC ---
+void command_queue_init(CommandQueue* q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
 
-            case B_ON_BRIDGE_TO_DEPOT:
-                target_x = BRIDGE_START_X;
-                if (self->x > target_x) self->x--;
-                else {
-                    pthread_mutex_unlock(&mutex_ponte);
-                    self->status = B_MOVING_TO_DEPOT;
-                }
-                break;
+static void command_queue_link(CommandQueue* q, SimCommand* n) {
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    SimCommand* prev = atomic_exchange_explicit(&q->head, n, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
 
-            case B_MOVING_TO_DEPOT:
-                if (self->x > DEPOT_X) self->x--;
-                else if (self->y > DEPOT_Y) self->y--;
-                else {
-                    self->status = B_RECHARGING;
-                }
-                break;
+/* Qualquer thread. Retorna false só se faltar memória. */
+bool command_queue_push(CommandQueue* q, SimCommandKind kind, int arg) {
+    SimCommand* n = malloc(sizeof(SimCommand));
+    if (!n) { perror("malloc"); return false; }
+    n->kind = kind;
+    n->arg = arg;
+    command_queue_link(q, n);
+    return true;
+}
 
-            case B_RECHARGING:
-                pthread_mutex_unlock(&self->mutex);
+/* Só o consumidor. Devolve o próximo comando (o chamador libera) ou NULL se
+   a fila está vazia ou um produtor ainda não terminou de ligar o nó. */
+SimCommand* command_queue_pop(CommandQueue* q) {
+    SimCommand* tail = q->tail;
+    SimCommand* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) return NULL;
+    command_queue_link(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (!next) return NULL;
+    q->tail = next;
+    return tail;
+}
 
-                pthread_mutex_lock(&mutex_deposito_access);
-                while (deposito_ocupado && game_running) {
-                    pthread_cond_wait(&cond_deposito_livre, &mutex_deposito_access);
-                }
-                if(!game_running) {
-                    pthread_mutex_unlock(&mutex_deposito_access);
-                    goto end_battery_loop;
-                }
-                deposito_ocupado = true;
-                pthread_mutex_unlock(&mutex_deposito_access);
+// --- Grade de ocupação ---
+static inline bool grid_in_bounds(const OccupancyGrid* g, int x, int y) {
+    return x >= 0 && x < g->width && y >= 0 && y < g->height;
+}
 
-                long recharge_duration_ms = self->recharge_min_ms + (rand() % (self->recharge_max_ms - self->recharge_min_ms + 1));
-                usleep(recharge_duration_ms * 1000); 
+static inline _Atomic(GridChunk*)* grid_chunk_slot(const OccupancyGrid* g, int x, int y) {
+    return &g->chunks[(size_t)(y >> GRID_CHUNK_SHIFT) * g->chunks_x + (x >> GRID_CHUNK_SHIFT)];
+}
 
-                pthread_mutex_lock(&self->mutex); 
-                self->ammo = self->max_ammo;
-                self->status = B_MOVING_FROM_DEPOT;
+static inline int grid_cell(int x, int y) {
+    return (y & (GRID_CHUNK - 1)) << GRID_CHUNK_SHIFT | (x & (GRID_CHUNK - 1));
+}
 
-                pthread_mutex_lock(&mutex_deposito_access);
-                deposito_ocupado = false;
-                pthread_cond_signal(&cond_deposito_livre);
-                pthread_mutex_unlock(&mutex_deposito_access);
-                break;
-            
-            /* ------------- FASE 2: volta do depósito para o combate ------------- */
-
-            /* 1) Do depósito até o início da ponte (permanece igual) */
-            case B_MOVING_FROM_DEPOT:
-                /* anda no solo até encostar na cabeceira ESQUERDA  (x = 10) */
-                if (self->x < BRIDGE_START_X)      self->x++;
-                /* depois sobe até o nível da ponte                    */
-                else if (self->y < BRIDGE_Y_LEVEL) self->y++;
-                /* chegou: pede o mutex e muda de estado                */
-                else                               self->status = B_REQUESTING_BRIDGE_TO_COMBAT;
-                break;
+/* Bloco da célula, ou NULL se ninguém escreveu nele ainda. */
+static inline GridChunk* grid_chunk(const OccupancyGrid* g, int x, int y) {
+    return atomic_load_explicit(grid_chunk_slot(g, x, y), memory_order_acquire);
+}
 
-            /* 2) Garante exclusão mútua (permanece igual) */
-            case B_REQUESTING_BRIDGE_TO_COMBAT:
-                pthread_mutex_unlock(&self->mutex);      /* libera o próprio mutex             */
-                pthread_mutex_lock(&mutex_ponte);        /* trava a ponte                      */
-                pthread_mutex_lock(&self->mutex);        /* volta a trancar a própria bateria  */
-                self->status = B_ON_BRIDGE_FROM_DEPOT;
-                break;
+/* Bloco da célula, alocando na primeira vez. Duas threads podem correr
+   para o mesmo bloco: quem perde o CAS descarta o seu e usa o do vencedor. */
+static GridChunk* grid_chunk_get(OccupancyGrid* g, int x, int y) {
+    _Atomic(GridChunk*)* slot = grid_chunk_slot(g, x, y);
+    GridChunk* c = atomic_load_explicit(slot, memory_order_acquire);
+    if (c) return c;
+    GridChunk* fresh = calloc(1, sizeof(GridChunk));
+    if (!fresh) { perror("calloc"); exit(1); }
+    if (atomic_compare_exchange_strong_explicit(slot, &c, fresh, memory_order_acq_rel, memory_order_acquire)) {
+        fresh->next_alloc = atomic_load_explicit(&g->allocated, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&g->allocated, &fresh->next_alloc, fresh,
+                                                      memory_order_release, memory_order_relaxed)) {}
+        return fresh;
+    }
+    free(fresh);
+    return c;
+}
 
-            /* 3) ATRAVESSA a ponte — agora sempre até BRIDGE_END_X     */
-            case B_ON_BRIDGE_FROM_DEPOT: {
-                const int target_x = BRIDGE_END_X;       /*  <-- 70 (cabeceira direita)        */
+static void grid_set_static(OccupancyGrid* g, int x, int y) {
+    int i = grid_cell(x, y);
+    grid_chunk_get(g, x, y)->static_bits[i >> 6] |= 1ULL << (i & 63);
+}
 
-                if (self->x < target_x) {
-                    self->x++;                           /* anda da esquerda (10) até (70)     */
-                } else {                                 /* chegou ao fim da ponte             */
-                    pthread_mutex_unlock(&mutex_ponte);  /* libera a ponte o mais cedo possível*/
-                    self->status = B_RETURNING_TO_COMBAT;
-                }
-                break;
-            }
+/* Marca depósito e vão da ponte; a borda é testada por conta em
+   grid_is_static. Plataforma e origem ficam livres. */
+static void grid_build_static(OccupancyGrid* g) {
+    grid_set_static(g, DEPOT_X, DEPOT_Y);
+    for (int x = BRIDGE_START_X; x <= BRIDGE_END_X; x++) grid_set_static(g, x, BRIDGE_Y_LEVEL);
+}
 
-            /* 4) Desce da ponte e solta o mutex                         */
-            case B_RETURNING_TO_COMBAT:
-                if (self->y < self->combat_y) {
-                    self->y++;                           /* descendo até o chão                */
-                } else {
-                    self->status = B_FINAL_POSITIONING;
-                }
-                break;
+void grid_init(OccupancyGrid* g, int width, int height) {
+    g->width = width;
+    g->height = height;
+    g->chunks_x = (width + GRID_CHUNK - 1) >> GRID_CHUNK_SHIFT;
+    g->chunks_y = (height + GRID_CHUNK - 1) >> GRID_CHUNK_SHIFT;
+    /* mmap anônimo: as páginas do diretório só viram memória quando um
+       bloco daquela faixa é alocado (com calloc o glibc pode zerar tudo) */
+    g->directory_bytes = (size_t)g->chunks_x * g->chunks_y * sizeof(*g->chunks);
+    g->chunks = mmap(NULL, g->directory_bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (g->chunks == MAP_FAILED) { perror("mmap"); exit(1); }
+    atomic_init(&g->allocated, NULL);
+    atomic_init(&g->focus_cx, 0);
+    atomic_init(&g->focus_cy, 0);
+    grid_build_static(g);
+}
 
-            case B_FINAL_POSITIONING:
-                if (self->x != self->combat_x) {
-                    if(self->x < self->combat_x) self->x++; else self->x--;
-                } else {
-                    self->status = B_FIRING;
-                }
-                break;
-        }
-        pthread_mutex_unlock(&self->mutex);
-        usleep(150000); 
-    }
-end_battery_loop:
-    if (pthread_mutex_trylock(&mutex_ponte) == 0) {
-        pthread_mutex_unlock(&mutex_ponte);
+void grid_free(OccupancyGrid* g) {
+    GridChunk* c = atomic_load(&g->allocated);
+    while (c) {
+        GridChunk* next = c->next_alloc;
+        free(c);
+        c = next;
     }
-    return NULL;
+    if (g->chunks) munmap(g->chunks, g->directory_bytes);
+    memset(g, 0, sizeof(*g));
 }
 
+static inline bool grid_is_static(const OccupancyGrid* g, int x, int y) {
+    if (x <= 0 || y <= 0 || x >= g->width - 1 || y >= g->height - 1) return true;
+    const GridChunk* c = grid_chunk(g, x, y);
+    int i = grid_cell(x, y);
+    return c && (c->static_bits[i >> 6] >> (i & 63)) & 1;
+}
 
-void* rocket_thread_func(void* arg) {
-    int rocket_idx = *((int*)arg);
-    Rocket* self = &active_rockets[rocket_idx];
+static inline int grid_count(OccupancyGrid* g, GridLayer l, int x, int y) {
+    GridChunk* c = grid_chunk(g, x, y);
+    return c ? atomic_load_explicit(&c->layers[l][grid_cell(x, y)], memory_order_relaxed) : 0;
+}
 
-    while (game_running) {
-        bool still_active = false;
-        
-        pthread_mutex_lock(&mutex_rocket_list);
-        if (self->active) {
-            self->precise_x += self->dx;
-            self->precise_y += self->dy;
-
-            self->x = (int)round(self->precise_x);
-            self->y = (int)round(self->precise_y);
-            
-            if (self->y < 0 || self->y >= SCREEN_HEIGHT || self->x < 0 || self->x >= SCREEN_WIDTH) {
-                self->active = false;
-            }
-            still_active = self->active;
-        }
-        pthread_mutex_unlock(&mutex_rocket_list);
+static inline void grid_add(OccupancyGrid* g, GridLayer l, int x, int y) {
+    if (!grid_in_bounds(g, x, y)) return;
+    atomic_fetch_add_explicit(&grid_chunk_get(g, x, y)->layers[l][grid_cell(x, y)], 1, memory_order_relaxed);
+}
 
-        if (!still_active) {
-            break; 
-        }
+/* Quem remove já adicionou antes, então o bloco existe. */
+static inline void grid_remove(OccupancyGrid* g, GridLayer l, int x, int y) {
+    if (!grid_in_bounds(g, x, y)) return;
+    atomic_fetch_sub_explicit(&grid_chunk(g, x, y)->layers[l][grid_cell(x, y)], 1, memory_order_relaxed);
+}
 
-        usleep(70000); 
-    }
-    return NULL;
+/* Recentra a área ativa no bloco de (x,y). Chamado a cada passo do
+   helicóptero. */
+static inline void grid_focus(OccupancyGrid* g, int x, int y) {
+    atomic_store_explicit(&g->focus_cx, x >> GRID_CHUNK_SHIFT, memory_order_relaxed);
+    atomic_store_explicit(&g->focus_cy, y >> GRID_CHUNK_SHIFT, memory_order_relaxed);
 }
 
-void* game_manager_thread_func(void* arg) {
-    while (game_running) {
-        pthread_mutex_lock(&game_state.mutex);
-        if (game_state.game_over_flag) {
-            game_running = false; 
-            pthread_mutex_unlock(&game_state.mutex);
-            break;
-        }
-        pthread_mutex_unlock(&game_state.mutex);
+/* Área ativa em células, [x0,x1) x [y0,y1): os blocos a até
+   GRID_ACTIVE_RADIUS do helicóptero, recortados pelo mapa. Só ali as
+   baterias atiram, e o foguete que sai dela é descartado. Fora dela o
+   resto do mundo continua sendo simulado: as baterias seguem atravessando
+   a ponte e recarregando, e o depósito continua a atendê-las. */
+static void grid_active_rect(const OccupancyGrid* g, int* x0, int* y0, int* x1, int* y1) {
+    int cx = atomic_load_explicit(&g->focus_cx, memory_order_relaxed);
+    int cy = atomic_load_explicit(&g->focus_cy, memory_order_relaxed);
+    *x0 = cx > GRID_ACTIVE_RADIUS ? (cx - GRID_ACTIVE_RADIUS) << GRID_CHUNK_SHIFT : 0;
+    *y0 = cy > GRID_ACTIVE_RADIUS ? (cy - GRID_ACTIVE_RADIUS) << GRID_CHUNK_SHIFT : 0;
+    *x1 = (cx + GRID_ACTIVE_RADIUS + 1) << GRID_CHUNK_SHIFT;
+    *y1 = (cy + GRID_ACTIVE_RADIUS + 1) << GRID_CHUNK_SHIFT;
+    if (*x1 > g->width) *x1 = g->width;
+    if (*y1 > g->height) *y1 = g->height;
+}
+
+static bool grid_active(const OccupancyGrid* g, int x, int y) {
+    int x0, y0, x1, y1;
+    grid_active_rect(g, &x0, &y0, &x1, &y1);
+    return x >= x0 && x < x1 && y >= y0 && y < y1;
+}
 
-        clear();
+static inline void grid_move(OccupancyGrid* g, GridLayer l, int old_x, int old_y, int x, int y) {
+    if (old_x == x && old_y == y) return;
+    grid_remove(g, l, old_x, old_y);
+    grid_add(g, l, x, y);
+}
 
-        for(int i=0; i<SCREEN_WIDTH; ++i) mvprintw(0, i, "-"); 
-        for(int i=0; i<SCREEN_WIDTH; ++i) mvprintw(SCREEN_HEIGHT-1, i, "-");
-        for(int i=1; i<SCREEN_HEIGHT-1; ++i) {mvprintw(i, 0, "|"); mvprintw(i, SCREEN_WIDTH-1, "|");}
-        
-        mvprintw(ORIGIN_Y, ORIGIN_X, "%c", PLATFORM_CHAR);
-        mvprintw(PLATFORM_Y, PLATFORM_X, "%c", PLATFORM_CHAR);
-        if (game_state.soldiers_at_origin_count > 0) {
-            mvprintw(ORIGIN_Y, ORIGIN_X, "%c", SOLDIER_CHAR);
+/* Verdadeiro se o segmento (x0,y0)-(x1,y1) toca a célula (cx,cy), que cobre
+   [c - 0.5, c + 0.5] nos dois eixos (o mesmo floor(p + 0.5) dos foguetes).
+   Teste de slabs de Liang-Barsky. */
+static bool segment_hits_cell(float x0, float y0, float x1, float y1, int cx, int cy) {
+    const float p[2] = { x0, y0 }, d[2] = { x1 - x0, y1 - y0 };
+    const float c[2] = { (float)cx, (float)cy };
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int a = 0; a < 2; a++) {
+        float lo = c[a] - 0.5f, hi = c[a] + 0.5f;
+        if (d[a] == 0.0f) {
+            if (p[a] < lo || p[a] > hi) return false;
+            continue;
         }
-        mvprintw(DEPOT_Y, DEPOT_X, "%c", DEPOT_CHAR);
-        for (int x = BRIDGE_START_X; x <= BRIDGE_END_X; ++x) {
-            mvprintw(BRIDGE_Y_LEVEL, x, "%c", BRIDGE_CHAR);
+        float ta = (lo - p[a]) / d[a], tb = (hi - p[a]) / d[a];
+        if (ta > tb) { float tmp = ta; ta = tb; tb = tmp; }
+        if (ta > t0) t0 = ta;
+        if (tb < t1) t1 = tb;
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+/* Primeira célula com entidades da camada l tocada pelo segmento entre os
+   centros de (x0,y0) e (x1,y1). Retorna false se não houver nenhuma. */
+static bool grid_sweep(OccupancyGrid* g, GridLayer l, int x0, int y0, int x1, int y1, int* hx, int* hy) {
+    int min_x = x0 < x1 ? x0 : x1, max_x = x0 < x1 ? x1 : x0;
+    int min_y = y0 < y1 ? y0 : y1, max_y = y0 < y1 ? y1 : y0;
+    for (int y = min_y; y <= max_y; y++) {
+        for (int x = min_x; x <= max_x; x++) {
+            if (!grid_in_bounds(g, x, y) || grid_count(g, l, x, y) == 0) continue;
+            if (segment_hits_cell(x0, y0, x1, y1, x, y)) {
+                *hx = x;
+                *hy = y;
+                return true;
+            }
         }
+    }
+    return false;
+}
 
+// --- Foguetes (SoA) ---
+/* aligned_alloc exige tamanho múltiplo do alinhamento (a máscara de um
+   bloco só tem 8 bytes), então arredonda para 32. */
+static void* rocket_alloc(size_t count, size_t elem_size) {
+    size_t bytes = (count * elem_size + 31) & ~(size_t)31;
+    void* p = aligned_alloc(32, bytes);
+    if (!p) { perror("aligned_alloc"); exit(1); }
+    memset(p, 0, bytes);
+    return p;
+}
 
-        // Helicóptero
-        pthread_mutex_lock(&helicopter.mutex);
-        if(helicopter.status != H_EXPLODED)
-            mvprintw(helicopter.y, helicopter.x, "%c", HELICOPTER_CHAR);
-        else
-             mvprintw(helicopter.y, helicopter.x, "X"); // Explosão
-        
-        pthread_mutex_unlock(&helicopter.mutex);
+void rocket_store_init(RocketStore* rs, int limit) {
+    rs->limit = limit;
+    rs->capacity = (limit + 63) & ~63;
+    rs->px = rocket_alloc(rs->capacity, sizeof(float));
+    rs->py = rocket_alloc(rs->capacity, sizeof(float));
+    rs->dx = rocket_alloc(rs->capacity, sizeof(float));
+    rs->dy = rocket_alloc(rs->capacity, sizeof(float));
+    rs->x = rocket_alloc(rs->capacity, sizeof(int));
+    rs->y = rocket_alloc(rs->capacity, sizeof(int));
+    rs->active_mask = rocket_alloc(rs->capacity / 64, sizeof(uint64_t));
+    rs->owner_battery_id = rocket_alloc(rs->capacity, sizeof(int));
+    rs->free_slots = rocket_alloc(rs->capacity, sizeof(int));
+    rs->free_top = 0;
+    for (int i = limit - 1; i >= 0; i--) rs->free_slots[rs->free_top++] = i;
+}
 
-        // HUD
-        mvprintw(SCREEN_HEIGHT -1 , SCREEN_WIDTH / 2 - 25, 
-            "Soldados a Bordo: %d | Resgatados: %d/%d | Restam na Ilha: %d",
-            helicopter.soldiers_on_board, helicopter.soldiers_rescued_total, SOLDIERS_TO_WIN,
-            game_state.soldiers_at_origin_count);
+void rocket_store_free(RocketStore* rs) {
+    free(rs->px); free(rs->py); free(rs->dx); free(rs->dy);
+    free(rs->x); free(rs->y);
+    free(rs->active_mask); free(rs->owner_battery_id); free(rs->free_slots);
+    memset(rs, 0, sizeof(*rs));
+}
 
+static inline bool rocket_is_active(const RocketStore* rs, int idx) {
+    return (rs->active_mask[idx >> 6] >> (idx & 63)) & 1;
+}
 
-        // Baterias
-        for (int i = 0; i < 2; i++) {
-            pthread_mutex_lock(&batteries[i].mutex);
-            mvprintw(batteries[i].y, batteries[i].x, "%c%d", BATTERY_CHAR, batteries[i].id);
-            
-            const char* status_str = "UNKNOWN";
-            switch(batteries[i].status){
-                case B_FIRING:                       status_str = "ATIRANDO     "; break;
-                case B_REQUESTING_BRIDGE_TO_DEPOT:   status_str = "AGUARD. PONTE"; break;
-                case B_MOVING_TO_BRIDGE:             status_str = "INDO P/ PONTE"; break;
-                case B_ON_BRIDGE_TO_DEPOT:           status_str = "NA PONTE -> D"; break;
-                case B_MOVING_TO_DEPOT:              status_str = "SAINDO P/ DEP"; break;
-                case B_RECHARGING:                   status_str = "RECARREGANDO "; break;
-                case B_MOVING_FROM_DEPOT:            status_str = "VOLTANDO PNT "; break;
-                case B_REQUESTING_BRIDGE_TO_COMBAT:  status_str = "AGUARD. PONTE"; break;
-                case B_ON_BRIDGE_FROM_DEPOT:         status_str = "NA PONTE -> C"; break;
-                case B_RETURNING_TO_COMBAT:          status_str = "SAINDO P/ CMB"; break;
-                case B_FINAL_POSITIONING:            status_str = "POS. FINAL   "; break;
-            }
-            mvprintw(0, 5 + i*25, "B%d: Ammo %2d/%-2d | Status: %s", 
-                i, batteries[i].ammo, batteries[i].max_ammo, status_str);
-            pthread_mutex_unlock(&batteries[i].mutex);
-        }
+/* Próximo slot ativo a partir de 'from', ou -1. Pula palavras vazias. */
+int rocket_store_next(const RocketStore* rs, int from) {
+    int words = rs->capacity / 64;
+    for (int w = from >> 6; w < words; w++) {
+        uint64_t bits = rs->active_mask[w];
+        if (w == (from >> 6)) bits &= ~0ULL << (from & 63);
+        if (bits) return w * 64 + __builtin_ctzll(bits);
+    }
+    return -1;
+}
 
-        // Foguetes
-        pthread_mutex_lock(&mutex_rocket_list);
-        for (int i = 0; i < MAX_ROCKETS; i++) {
-            if (active_rockets[i].active) {
-                mvprintw(active_rockets[i].y, active_rockets[i].x, "%c", ROCKET_CHAR);
-            }
-        }
-        pthread_mutex_unlock(&mutex_rocket_list);
+/* Reserva um slot em O(1) e inicializa o foguete. Chamar com
+   mutex_rocket_list travado. Retorna -1 se todos os slots estiverem em uso. */
+int rocket_spawn(RocketStore* rs, OccupancyGrid* g, int x, int y, float dx, float dy, int owner) {
+    if (rs->free_top == 0) return -1;
+    int idx = rs->free_slots[--rs->free_top];
+    rs->px[idx] = x;
+    rs->py[idx] = y;
+    rs->x[idx] = x;
+    rs->y[idx] = y;
+    rs->dx[idx] = dx;
+    rs->dy[idx] = dy;
+    rs->owner_battery_id[idx] = owner;
+    rs->active_mask[idx >> 6] |= 1ULL << (idx & 63);
+    grid_add(g, GRID_ROCKETS, x, y);
+    trace_instant("foguete", "spawn", "slot", idx);
+    return idx;
+}
 
-        refresh();
-        usleep(50000); 
-    }
+/* Devolve o slot à pilha de livres. Chamar com mutex_rocket_list travado.
+   A velocidade é zerada para que as raias inativas do kernel não derivem. */
+void rocket_release(RocketStore* rs, OccupancyGrid* g, int idx) {
+    if (!rocket_is_active(rs, idx)) return;
+    grid_remove(g, GRID_ROCKETS, rs->x[idx], rs->y[idx]);
+    rs->active_mask[idx >> 6] &= ~(1ULL << (idx & 63));
+    rs->dx[idx] = 0;
+    rs->dy[idx] = 0;
+    rs->free_slots[rs->free_top++] = idx;
+    trace_instant("foguete", "despawn", "slot", idx);
+}
+
+/* Integra as 64 raias do bloco 'base' e devolve a máscara das que saíram
+   da área ativa [x0,x1) x [y0,y1). Raias inativas também são calculadas (vetores
+   cheios), mas o chamador só considera os bits ativos. O arredondamento é
+   floor(p + 0.5) em todos os caminhos para que SIMD e escalar concordem. */
+static uint64_t rocket_integrate_block(RocketStore* rs, int base, uint64_t live, int x0, int y0, int x1, int y1) {
+    uint64_t out = 0;
+#if defined(__AVX2__)
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256i x_lo = _mm256_set1_epi32(x0 - 1);
+    const __m256i y_lo = _mm256_set1_epi32(y0 - 1);
+    const __m256i w_lim = _mm256_set1_epi32(x1);
+    const __m256i h_lim = _mm256_set1_epi32(y1);
+    for (int j = 0; j < 64; j += 8) {
+        if (((live >> j) & 0xFF) == 0) continue;
+        int i = base + j;
+        __m256 px = _mm256_add_ps(_mm256_load_ps(rs->px + i), _mm256_load_ps(rs->dx + i));
+        __m256 py = _mm256_add_ps(_mm256_load_ps(rs->py + i), _mm256_load_ps(rs->dy + i));
+        _mm256_store_ps(rs->px + i, px);
+        _mm256_store_ps(rs->py + i, py);
+        __m256i cx = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(px, half)));
+        __m256i cy = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(py, half)));
+        _mm256_store_si256((__m256i*)(rs->x + i), cx);
+        _mm256_store_si256((__m256i*)(rs->y + i), cy);
+        __m256i in_x = _mm256_and_si256(_mm256_cmpgt_epi32(cx, x_lo), _mm256_cmpgt_epi32(w_lim, cx));
+        __m256i in_y = _mm256_and_si256(_mm256_cmpgt_epi32(cy, y_lo), _mm256_cmpgt_epi32(h_lim, cy));
+        int inside = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(in_x, in_y)));
+        out |= (uint64_t)(~inside & 0xFF) << j;
+    }
+#elif defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i x_lo = _mm_set1_epi32(x0 - 1);
+    const __m128i y_lo = _mm_set1_epi32(y0 - 1);
+    const __m128i w_lim = _mm_set1_epi32(x1);
+    const __m128i h_lim = _mm_set1_epi32(y1);
+    for (int j = 0; j < 64; j += 4) {
+        if (((live >> j) & 0xF) == 0) continue;
+        int i = base + j;
+        __m128 px = _mm_add_ps(_mm_load_ps(rs->px + i), _mm_load_ps(rs->dx + i));
+        __m128 py = _mm_add_ps(_mm_load_ps(rs->py + i), _mm_load_ps(rs->dy + i));
+        _mm_store_ps(rs->px + i, px);
+        _mm_store_ps(rs->py + i, py);
+        /* floor sem SSE4.1: trunca e corrige quando o truncamento subiu */
+        __m128 vx = _mm_add_ps(px, half);
+        __m128 vy = _mm_add_ps(py, half);
+        __m128 tx = _mm_cvtepi32_ps(_mm_cvttps_epi32(vx));
+        __m128 ty = _mm_cvtepi32_ps(_mm_cvttps_epi32(vy));
+        tx = _mm_sub_ps(tx, _mm_and_ps(_mm_cmpgt_ps(tx, vx), one));
+        ty = _mm_sub_ps(ty, _mm_and_ps(_mm_cmpgt_ps(ty, vy), one));
+        __m128i cx = _mm_cvttps_epi32(tx);
+        __m128i cy = _mm_cvttps_epi32(ty);
+        _mm_store_si128((__m128i*)(rs->x + i), cx);
+        _mm_store_si128((__m128i*)(rs->y + i), cy);
+        __m128i in_x = _mm_and_si128(_mm_cmpgt_epi32(cx, x_lo), _mm_cmplt_epi32(cx, w_lim));
+        __m128i in_y = _mm_and_si128(_mm_cmpgt_epi32(cy, y_lo), _mm_cmplt_epi32(cy, h_lim));
+        int inside = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(in_x, in_y)));
+        out |= (uint64_t)(~inside & 0xF) << j;
+    }
+#else
+    for (int j = 0; j < 64; j++) {
+        if (!((live >> j) & 1)) continue;
+        int i = base + j;
+        rs->px[i] += rs->dx[i];
+        rs->py[i] += rs->dy[i];
+        rs->x[i] = (int)floorf(rs->px[i] + 0.5f);
+        rs->y[i] = (int)floorf(rs->py[i] + 0.5f);
+        if (rs->x[i] < x0 || rs->x[i] >= x1 || rs->y[i] < y0 || rs->y[i] >= y1)
+            out |= 1ULL << j;
+    }
+#endif
+    return out & live;
+}
+
+/* Avança os foguetes dos blocos [word_lo, word_hi) e atualiza a grade com
+   quem mudou de célula. Os que saíram da área ativa voltam à última célula e vão
+   para 'culled' (até 64 por bloco); quem chama os libera depois. Não mexe
+   na pilha de livres, então blocos distintos podem rodar em paralelo.
+   Com target, o segmento percorrido neste passo é testado contra a célula
+   do alvo: o primeiro foguete que a atravessa vai para *hit (e para
+   'culled'), mesmo que o ponto final tenha passado dela. */
+int rocket_store_step_blocks(RocketStore* rs, OccupancyGrid* g, int word_lo, int word_hi,
+                             const SweepTarget* target, int* culled, int* hit) {
+    int old_x[64], old_y[64];
+    int n = 0;
+    int x0, y0, x1, y1;
+    grid_active_rect(g, &x0, &y0, &x1, &y1);
+    for (int w = word_lo; w < word_hi; w++) {
+        uint64_t live = rs->active_mask[w];
+        if (!live) continue;
+        int base = w * 64;
+        memcpy(old_x, rs->x + base, sizeof old_x);
+        memcpy(old_y, rs->y + base, sizeof old_y);
+
+        uint64_t out = rocket_integrate_block(rs, base, live, x0, y0, x1, y1);
+
+        for (uint64_t bits = live; bits; bits &= bits - 1) {
+            int j = __builtin_ctzll(bits);
+            int i = base + j;
+            bool swept = target && *hit < 0 &&
+                         segment_hits_cell(rs->px[i] - rs->dx[i], rs->py[i] - rs->dy[i],
+                                           rs->px[i], rs->py[i], target->x, target->y);
+            if (swept) *hit = i;
+            if (swept || ((out >> j) & 1)) {
+                /* sai da grade pela célula onde estava */
+                rs->x[base + j] = old_x[j];
+                rs->y[base + j] = old_y[j];
+                culled[n++] = base + j;
+            } else {
+                grid_move(g, GRID_ROCKETS, old_x[j], old_y[j], rs->x[base + j], rs->y[base + j]);
+            }
+        }
+    }
+    return n;
+}
+
+/* Avança todos os foguetes ativos e descarta os que saíram da área ou
+   acertaram o alvo. Retorna o foguete que acertou, ou -1. Chamar com
+   mutex_rocket_list travado. */
+int rocket_store_step(RocketStore* rs, OccupancyGrid* g, const SweepTarget* target) {
+    int culled[64];
+    int hit = -1;
+    for (int w = 0; w < rs->capacity / 64; w++) {
+        int n = rocket_store_step_blocks(rs, g, w, w + 1, target, culled, &hit);
+        for (int k = 0; k < n; k++) rocket_release(rs, g, culled[k]);
+    }
+    return hit;
+}
+
+// --- Roda de temporizadores ---
+/* Coloca t no nível cujo alcance cobre (expires - now). Prazos vencidos
+   disparam no próximo tick processado; além de 64^4 ticks o prazo é truncado. */
+static void wheel_insert(TimerWheel* tw, Timer* t) {
+    if (t->expires < tw->now) t->expires = tw->now;
+    uint64_t delta = t->expires - tw->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1))) level++;
+    if (delta >> (WHEEL_BITS * WHEEL_LEVELS)) t->expires = tw->now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    int slot = (t->expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    t->next = tw->slots[level][slot];
+    tw->slots[level][slot] = t;
+    tw->occupied[level] |= 1ULL << slot;
+}
+
+/* Redistribui o slot do nível 'level' que corresponde ao tick atual. */
+static void wheel_cascade(TimerWheel* tw, int level) {
+    int slot = (tw->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    Timer* t = tw->slots[level][slot];
+    tw->slots[level][slot] = NULL;
+    tw->occupied[level] &= ~(1ULL << slot);
+    while (t) {
+        Timer* next = t->next;
+        wheel_insert(tw, t);
+        t = next;
+    }
+}
+
+/* Processa o tick tw->now: cascateia os níveis superiores nas viradas e
+   devolve a lista de timers vencidos (ordem arbitrária). */
+static Timer* wheel_collect(TimerWheel* tw) {
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (tw->now & ((1ULL << (WHEEL_BITS * level)) - 1)) break;
+        wheel_cascade(tw, level);
+    }
+    int slot = tw->now & (WHEEL_SLOTS - 1);
+    Timer* list = tw->slots[0][slot];
+    tw->slots[0][slot] = NULL;
+    tw->occupied[0] &= ~(1ULL << slot);
+    tw->now++;
+    return list;
+}
+
+/* Menor tick >= now que precisa ser processado (um slot do nível 0 ou a
+   próxima virada com níveis superiores ocupados), limitado a 'limit'. Os
+   ticks vazios no meio podem ser pulados sem perder cascatas. */
+static uint64_t wheel_next_tick(const TimerWheel* tw, uint64_t limit) {
+    uint64_t bits = tw->occupied[0] >> (tw->now & (WHEEL_SLOTS - 1));
+    uint64_t next;
+    if (bits) {
+        next = tw->now + __builtin_ctzll(bits);
+    } else {
+        bool pending = tw->occupied[0];
+        for (int level = 1; level < WHEEL_LEVELS; level++) pending |= tw->occupied[level] != 0;
+        if (!pending) return limit;
+        next = (tw->now | (WHEEL_SLOTS - 1)) + 1;
+    }
+    return next < limit ? next : limit;
+}
+
+/* Arma (ou rearma) um timer. O timer não pode estar armado. */
+void world_arm_timer(World* w, Timer* t, uint64_t expires) {
+    GAME_LOCK(&w->timer_mutex);
+    t->expires = expires;
+    wheel_insert(&w->timers, t);
+    GAME_UNLOCK(&w->timer_mutex);
+}
+
+/* Período em ticks (arredondado, no mínimo 1). */
+static uint64_t world_period_ticks(const World* w, long period_ms) {
+    long ticks = (period_ms + w->config.tick_ms / 2) / w->config.tick_ms;
+    return ticks < 1 ? 1 : (uint64_t)ticks;
+}
+
+/* Primeiro tick cujo instante não é anterior a ms. */
+static uint64_t world_tick_at_ms(const World* w, long ms) {
+    long rel = ms - w->timer_epoch_ms;
+    return rel <= 0 ? 0 : (uint64_t)((rel + w->config.tick_ms - 1) / w->config.tick_ms);
+}
+
+static int timer_order(const void* a, const void* b) {
+    const Timer* ta = *(Timer* const*)a;
+    const Timer* tb = *(Timer* const*)b;
+    if (ta->kind != tb->kind) return (int)ta->kind - (int)tb->kind;
+    return ta->id - tb->id;
+}
+
+/* Coleta o tick w->timers.now em w->due, ordenado por (tipo, id). */
+static void world_collect_due(World* w) {
+    GAME_LOCK(&w->timer_mutex);
+    Timer* list = wheel_collect(&w->timers);
+    GAME_UNLOCK(&w->timer_mutex);
+    w->due_count = 0;
+    for (Timer* t = list; t; t = t->next) {
+        if (w->due_count == w->due_cap) {
+            w->due_cap = w->due_cap ? w->due_cap * 2 : 64;
+            w->due = realloc(w->due, w->due_cap * sizeof(Timer*));
+            if (!w->due) { perror("realloc"); exit(1); }
+        }
+        w->due[w->due_count++] = t;
+    }
+    qsort(w->due, w->due_count, sizeof(Timer*), timer_order);
+}
+
+/* Dispara um timer de simulação e rearma o que for periódico. O passo do
+   helicóptero é tratado por quem roda a partida (política ou teclado). */
+void timer_fire(World* w, Timer* t) {
+    uint64_t start = trace_begin();
+    switch (t->kind) {
+        case TIMER_ROCKETS:
+            rockets_step(w);
+            world_arm_timer(w, t, t->expires + world_period_ticks(w, w->config.physics_ms));
+            trace_span("passo", "foguetes", start, NULL, 0);
+            break;
+        case TIMER_BATTERY:
+            /* durante a recarga o passo fica desarmado; o fim da recarga o rearma */
+            if (battery_step(w, &w->batteries[t->id])) {
+                world_arm_timer(w, t, t->expires + world_period_ticks(w, BATTERY_STEP_MS));
+            }
+            trace_span("passo", "bateria", start, "id", t->id);
+            break;
+        case TIMER_RECHARGE: {
+            Battery* b = &w->batteries[t->id];
+            battery_finish_recharge(w, b);
+            world_arm_timer(w, &b->step_timer, t->expires + world_period_ticks(w, BATTERY_STEP_MS));
+            trace_span("passo", "fim da recarga", start, "id", t->id);
+            break;
+        }
+        case TIMER_HELICOPTER:
+            break;
+    }
+}
+
+/* Arma os passos periódicos no tick 0. */
+static void world_start_timers(World* w, bool with_helicopter) {
+    world_arm_timer(w, &w->rockets_timer, 0);
+    for (int i = 0; i < w->config.battery_count; i++) {
+        world_arm_timer(w, &w->batteries[i].step_timer, 0);
+        trace_async('b', "bateria", battery_state_names[w->batteries[i].status], i);
+    }
+    if (with_helicopter) world_arm_timer(w, &w->helicopter_timer, 0);
+}
+
+// --- Relógio ---
+static long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+long sim_now_ms(World* w) {
+    if (w->headless || w->deterministic) return w->clock_ms;
+    return monotonic_ms();
+}
+
+// --- Snapshots do mundo ---
+static void snapshot_alloc(World* w, WorldSnapshot* snap) {
+    memset(snap, 0, sizeof(*snap));
+    snap->batteries = calloc(w->config.battery_count ? w->config.battery_count : 1, sizeof(BatterySnapshot));
+    snap->rockets = calloc(w->rockets.limit, sizeof(RocketSnapshot));
+    if (!snap->batteries || !snap->rockets) { perror("calloc"); exit(1); }
+}
+
+/* Cria um canal de leitura. Chamar antes de iniciar as threads. */
+SnapshotChannel* snapshot_channel_create(World* w) {
+    if (w->snapshot_channel_count == MAX_SNAPSHOT_CHANNELS) return NULL;
+    SnapshotChannel* c = calloc(1, sizeof(SnapshotChannel));
+    if (!c) { perror("calloc"); exit(1); }
+    for (int i = 0; i < 3; i++) snapshot_alloc(w, &c->bufs[i]);
+    c->back = 0;
+    atomic_init(&c->middle, 1);
+    c->front = 2;
+    w->snapshot_channels[w->snapshot_channel_count++] = c;
+    return c;
+}
+
+void snapshot_channel_free(SnapshotChannel* c) {
+    for (int i = 0; i < 3; i++) {
+        free(c->bufs[i].batteries);
+        free(c->bufs[i].rockets);
+    }
+    free(c);
+}
+
+/* Copia o estado atual como um quadro só. Chamar com baterias e foguetes
+   parados (entre ticks, ou antes de as threads subirem): as baterias só
+   mudam nos próprios timers e são lidas sem lock. O helicopter.mutex fica
+   travado até o fim, então nenhum passo do helicóptero cai no meio da
+   cópia; game_state e a lista de foguetes vêm depois dele, na mesma ordem
+   do helicopter_step. */
+static void snapshot_capture(World* w, WorldSnapshot* snap) {
+    snap->seq = ++w->snapshot_seq;
+    snap->clock_ms = sim_now_ms(w);
+    snap->soldiers_to_win = w->config.soldier_count;
+    snap->map_width = w->config.map_width;
+    snap->map_height = w->config.map_height;
+
+    GAME_LOCK(&w->helicopter.mutex);
+    GAME_LOCK(&w->game_state.mutex);
+    snap->heli_x = w->helicopter.x;
+    snap->heli_y = w->helicopter.y;
+    snap->heli_status = w->helicopter.status;
+    snap->soldiers_on_board = w->helicopter.soldiers_on_board;
+    snap->soldiers_rescued_total = w->helicopter.soldiers_rescued_total;
+    snap->soldiers_at_origin = w->game_state.soldiers_at_origin_count;
+    snap->game_over = w->game_state.game_over_flag;
+    snap->victory = w->game_state.victory_flag;
+    GAME_UNLOCK(&w->game_state.mutex);
+
+    GAME_LOCK(&w->bridge.mutex);
+    snap->bridge_queue = w->bridge.waiting[0] + w->bridge.waiting[1];
+    GAME_UNLOCK(&w->bridge.mutex);
+
+    snap->battery_count = w->config.battery_count;
+    for (int i = 0; i < w->config.battery_count; i++) {
+        Battery* b = &w->batteries[i];
+        BatterySnapshot* bs = &snap->batteries[i];
+        bs->id = b->id;
+        bs->x = b->x;
+        bs->y = b->y;
+        bs->ammo = b->ammo;
+        bs->max_ammo = b->max_ammo;
+        bs->status = b->status;
+    }
+
+    int n = 0;
+    GAME_LOCK(&w->mutex_rocket_list);
+    for (int i = rocket_store_next(&w->rockets, 0); i >= 0; i = rocket_store_next(&w->rockets, i + 1)) {
+        snap->rockets[n].x = w->rockets.x[i];
+        snap->rockets[n].y = w->rockets.y[i];
+        n++;
+    }
+    GAME_UNLOCK(&w->mutex_rocket_list);
+    snap->rocket_count = n;
+    GAME_UNLOCK(&w->helicopter.mutex);
+}
+
+static void snapshot_copy(WorldSnapshot* dst, const WorldSnapshot* src) {
+    BatterySnapshot* batteries = dst->batteries;
+    RocketSnapshot* rockets = dst->rockets;
+    *dst = *src;
+    dst->batteries = batteries;
+    dst->rockets = rockets;
+    memcpy(batteries, src->batteries, src->battery_count * sizeof(BatterySnapshot));
+    memcpy(rockets, src->rockets, src->rocket_count * sizeof(RocketSnapshot));
+}
+
+// --- Anel em memória compartilhada (--publish) ---
+static size_t shm_slot_bytes(int batteries, int rockets) {
+    size_t bytes = sizeof(ShmFrame) + (size_t)batteries * sizeof(ShmBattery) + (size_t)rockets * sizeof(ShmRocket);
+    return (bytes + 63) & ~(size_t)63;
+}
+
+static ShmFrame* shm_slot(const ShmHeader* hdr, uint64_t index) {
+    return (ShmFrame*)((const char*)(hdr + 1) + (index % hdr->slot_count) * hdr->slot_bytes);
+}
+
+/* Nome de objeto POSIX: uma barra e nada mais. */
+static void shm_object_name(char* out, size_t size, const char* name) {
+    snprintf(out, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+/* Cria (ou recria) o objeto e o anel vazio. Chamar antes das threads. */
+ShmRing* shm_ring_create(World* w, const char* name) {
+    ShmRing* r = calloc(1, sizeof(ShmRing));
+    if (!r) { perror("calloc"); return NULL; }
+    shm_object_name(r->name, sizeof r->name, name);
+    size_t slot_bytes = shm_slot_bytes(w->config.battery_count, w->rockets.limit);
+    r->bytes = sizeof(ShmHeader) + SHM_RING_SLOTS * slot_bytes;
+    int fd = shm_open(r->name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) { perror(r->name); free(r); return NULL; }
+    if (ftruncate(fd, (off_t)r->bytes) < 0) {
+        perror("ftruncate"); close(fd); shm_unlink(r->name); free(r); return NULL;
+    }
+    r->hdr = mmap(NULL, r->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->hdr == MAP_FAILED) { perror("mmap"); shm_unlink(r->name); free(r); return NULL; }
+    r->hdr->version = SHM_VERSION;
+    r->hdr->slot_count = SHM_RING_SLOTS;
+    r->hdr->slot_bytes = (uint32_t)slot_bytes;
+    r->hdr->map_width = w->config.map_width;
+    r->hdr->map_height = w->config.map_height;
+    r->hdr->max_batteries = w->config.battery_count;
+    r->hdr->max_rockets = w->rockets.limit;
+    atomic_store(&r->hdr->published, 0);
+    atomic_store(&r->hdr->closed, 0);
+    atomic_store_explicit(&r->hdr->magic, SHM_MAGIC, memory_order_release);
+    snapshot_alloc(w, &r->capture);
+    return r;
+}
+
+/* Copia o snapshot para o próximo slot. Só um escritor (snapshot_mutex). */
+static void shm_ring_publish(ShmRing* r, const WorldSnapshot* snap) {
+    ShmHeader* hdr = r->hdr;
+    uint64_t index = atomic_load_explicit(&hdr->published, memory_order_relaxed);
+    ShmFrame* f = shm_slot(hdr, index);
+    uint64_t seq = atomic_load_explicit(&f->seq, memory_order_relaxed);
+    atomic_store_explicit(&f->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    f->index = index;
+    f->clock_ms = snap->clock_ms;
+    f->heli_x = snap->heli_x;
+    f->heli_y = snap->heli_y;
+    f->heli_status = snap->heli_status;
+    f->soldiers_on_board = snap->soldiers_on_board;
+    f->soldiers_rescued_total = snap->soldiers_rescued_total;
+    f->soldiers_at_origin = snap->soldiers_at_origin;
+    f->soldiers_to_win = snap->soldiers_to_win;
+    f->bridge_queue = snap->bridge_queue;
+    f->game_over = snap->game_over;
+    f->victory = snap->victory;
+    f->battery_count = snap->battery_count;
+    f->rocket_count = snap->rocket_count;
+    ShmBattery* b = (ShmBattery*)(f + 1);
+    for (int i = 0; i < snap->battery_count; i++) {
+        const BatterySnapshot* bs = &snap->batteries[i];
+        b[i] = (ShmBattery){ bs->x, bs->y, bs->ammo, bs->max_ammo, bs->status };
+    }
+    ShmRocket* rk = (ShmRocket*)(b + snap->battery_count);
+    for (int i = 0; i < snap->rocket_count; i++) rk[i] = (ShmRocket){ snap->rockets[i].x, snap->rockets[i].y };
+
+    atomic_store_explicit(&f->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&hdr->published, index + 1, memory_order_release);
+}
+
+/* Marca o fim para quem está lendo e remove o nome; leitores já
+   conectados continuam com o mapeamento até saírem. */
+void shm_ring_close(ShmRing* r) {
+    if (!r) return;
+    atomic_store_explicit(&r->hdr->closed, 1, memory_order_release);
+    munmap(r->hdr, r->bytes);
+    shm_unlink(r->name);
+    free(r->capture.batteries);
+    free(r->capture.rockets);
+    free(r);
+}
+
+/* Publica o estado atual em todos os canais e no anel compartilhado.
+   Chamado pelas threads da simulação depois de cada passo; os leitores
+   nunca seguram esses locks. */
+void world_publish_snapshot(World* w) {
+    if (w->snapshot_channel_count == 0 && !w->shm) return;
+    GAME_LOCK(&w->snapshot_mutex);
+    SnapshotChannel* first = w->snapshot_channel_count ? w->snapshot_channels[0] : NULL;
+    WorldSnapshot* snap = first ? &first->bufs[first->back] : &w->shm->capture;
+    snapshot_capture(w, snap);
+    for (int i = 0; i < w->snapshot_channel_count; i++) {
+        SnapshotChannel* c = w->snapshot_channels[i];
+        if (i > 0) snapshot_copy(&c->bufs[c->back], snap);
+        c->back = atomic_exchange(&c->middle, c->back | SNAPSHOT_FRESH) & 3u;
+    }
+    if (w->shm) shm_ring_publish(w->shm, snap);
+    GAME_UNLOCK(&w->snapshot_mutex);
+}
+
+/* Pede um quadro imediato ao renderizador. */
+void world_kick_render(World* w) {
+    pthread_mutex_lock(&w->render_mutex);
+    w->render_kicked = true;
+    pthread_cond_signal(&w->render_cond);
+    pthread_mutex_unlock(&w->render_mutex);
+}
+
+/* Fim de jogo: derruba w->running e acorda na hora todas as esperas (relógio,
+   teclado e renderizador), em vez de cada uma notar só quando expirar. O
+   eventfd nunca é lido, então fica sinalizado para quem chegar depois. */
+void world_shutdown(World* w) {
+    w->running = false;
+    uint64_t one = 1;
+    if (w->shutdown_fd >= 0 && write(w->shutdown_fd, &one, sizeof one) < 0 && errno != EAGAIN) {
+        perror("eventfd");
+    }
+    pthread_mutex_lock(&w->render_mutex);
+    pthread_cond_broadcast(&w->render_cond);
+    pthread_mutex_unlock(&w->render_mutex);
+}
+
+/* Dorme até timeout_ms ou até o fim de jogo. Retorna false se o jogo acabou. */
+bool world_sleep(World* w, long timeout_ms) {
+    if (w->shutdown_fd < 0) {
+        usleep(timeout_ms * 1000);
+    } else {
+        struct pollfd pfd = { .fd = w->shutdown_fd, .events = POLLIN };
+        if (poll(&pfd, 1, (int)timeout_ms) < 0 && errno != EINTR) perror("poll");
+    }
+    return w->running;
+}
+
+/* Espera até timeout_ms ou até um world_kick_render(). */
+void world_wait_render(World* w, long timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&w->render_mutex);
+    while (!w->render_kicked && w->running) {
+        if (pthread_cond_timedwait(&w->render_cond, &w->render_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    w->render_kicked = false;
+    pthread_mutex_unlock(&w->render_mutex);
+}
+
+/* Pega o snapshot mais recente do canal (wait-free). Retorna false se não
+   houve publicação desde a última leitura; *out aponta para o último lido. */
+bool snapshot_acquire(SnapshotChannel* c, const WorldSnapshot** out) {
+    if (atomic_load(&c->middle) & SNAPSHOT_FRESH) {
+        c->front = atomic_exchange(&c->middle, c->front) & 3u;
+        *out = &c->bufs[c->front];
+        return true;
+    }
+    *out = &c->bufs[c->front];
+    return false;
+}
+
+// --- Funções Auxiliares ---
+void world_config_default(WorldConfig* cfg) {
+    cfg->battery_count = DEFAULT_BATTERIES;
+    cfg->rocket_slots = MAX_ROCKETS;
+    cfg->soldier_count = INITIAL_SOLDIERS_AT_ORIGIN;
+    cfg->tick_ms = SIM_TICK_MS;
+    cfg->physics_ms = ROCKET_STEP_MS;
+    cfg->depot_slots = DEFAULT_DEPOT_SLOTS;
+    cfg->depot_policy = DEPOT_LOWEST_AMMO;
+    cfg->map_width = SCREEN_WIDTH;
+    cfg->map_height = SCREEN_HEIGHT;
+}
+
+/* Posição de combate da bateria i entre n: espalhadas em colunas entre
+   BATTERY_COMBAT_MIN_X e BATTERY_COMBAT_MAX_X; quando as colunas acabam,
+   sobem uma fileira e, depois de BATTERY_COMBAT_ROWS, empilham. */
+static void battery_combat_position(int i, int n, int* x, int* y) {
+    int columns = BATTERY_COMBAT_MAX_X - BATTERY_COMBAT_MIN_X + 1;
+    int per_row = n < columns ? n : columns;
+    int col = i % per_row;
+    int row = (i / per_row) % BATTERY_COMBAT_ROWS;
+    *x = per_row > 1 ? BATTERY_COMBAT_MIN_X + col * (columns - 1) / (per_row - 1)
+                     : (BATTERY_COMBAT_MIN_X + BATTERY_COMBAT_MAX_X) / 2;
+    *y = BATTERY_COMBAT_Y - row;
+}
+
+/* Inicializa a partida. O chamador preenche antes config, difficulty,
+   headless e seed. Os pools de entidades são alocados aqui, uma vez. */
+void init_game_elements(World* w) {
+    w->running = true;
+    w->shutdown_fd = -1;
+    if (!w->headless) { // o headless não espera nada
+        w->shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (w->shutdown_fd < 0) { perror("eventfd"); exit(1); }
+    }
+    w->clock_ms = 0;
+    memset(&w->stats, 0, sizeof(w->stats));
+    w->stats.end_ms = -1;
+
+    // Helicóptero
+    pthread_mutex_init(&w->helicopter.mutex, NULL);
+    GAME_LOCK(&w->helicopter.mutex);
+    w->helicopter.x = PLATFORM_X;
+    w->helicopter.y = PLATFORM_Y;
+    w->helicopter.soldiers_on_board = 0;
+    w->helicopter.soldiers_rescued_total = 0;
+    w->helicopter.status = H_ACTIVE;
+    GAME_UNLOCK(&w->helicopter.mutex);
+
+    // Estado do Jogo
+    pthread_mutex_init(&w->game_state.mutex, NULL);
+    GAME_LOCK(&w->game_state.mutex);
+    w->game_state.game_over_flag = false;
+    w->game_state.victory_flag = false;
+    w->game_state.soldiers_at_origin_count = w->config.soldier_count;
+    GAME_UNLOCK(&w->game_state.mutex);
+
+    // Grade de ocupação
+    grid_init(&w->grid, w->config.map_width, w->config.map_height);
+    grid_focus(&w->grid, PLATFORM_X, PLATFORM_Y);
+
+    // Escalonador (os timers são armados por quem roda a partida)
+    memset(&w->timers, 0, sizeof(w->timers));
+    pthread_mutex_init(&w->timer_mutex, NULL);
+    w->timer_epoch_ms = 0;
+    w->rockets_timer = (Timer){ .kind = TIMER_ROCKETS };
+    w->helicopter_timer = (Timer){ .kind = TIMER_HELICOPTER };
+    w->due = NULL;
+    w->due_count = w->due_cap = 0;
+
+    // Soldados
+    w->last_board_ms = 0;
+    w->soldiers = calloc(w->config.soldier_count, sizeof(Soldier));
+    if (!w->soldiers) { perror("calloc"); exit(1); }
+    for (int i = 0; i < w->config.soldier_count; ++i) {
+        w->soldiers[i].x      = ORIGIN_X;
+        w->soldiers[i].y      = ORIGIN_Y;
+        w->soldiers[i].active = true;
+        grid_add(&w->grid, GRID_SOLDIERS, ORIGIN_X, ORIGIN_Y);
+    }
+
+    // Baterias
+    int base_ammo;
+    long min_recharge, max_recharge;
+
+    if (w->difficulty == 1) { // Fácil
+        base_ammo = MAX_AMMO_EASY;
+        min_recharge = RECHARGE_TIME_EASY_MIN_MS;
+        max_recharge = RECHARGE_TIME_EASY_MAX_MS;
+    } else if (w->difficulty == 2) { // Médio
+        base_ammo = MAX_AMMO_MEDIUM;
+        min_recharge = RECHARGE_TIME_MEDIUM_MIN_MS;
+        max_recharge = RECHARGE_TIME_MEDIUM_MAX_MS;
+    } else { // Difícil
+        base_ammo = MAX_AMMO_HARD;
+        min_recharge = RECHARGE_TIME_HARD_MIN_MS;
+        max_recharge = RECHARGE_TIME_HARD_MAX_MS;
+    }
+
+
+    w->batteries = calloc(w->config.battery_count ? w->config.battery_count : 1, sizeof(Battery));
+    if (!w->batteries) { perror("calloc"); exit(1); }
+    for (int i = 0; i < w->config.battery_count; i++) {
+        pthread_mutex_init(&w->batteries[i].mutex, NULL);
+        GAME_LOCK(&w->batteries[i].mutex);
+        w->batteries[i].id = i;
+        battery_combat_position(i, w->config.battery_count, &w->batteries[i].combat_x, &w->batteries[i].combat_y);
+        w->batteries[i].x = w->batteries[i].combat_x;
+        w->batteries[i].y = w->batteries[i].combat_y;
+        w->batteries[i].ammo = base_ammo;
+        w->batteries[i].max_ammo = base_ammo;
+        w->batteries[i].status = B_FIRING;
+        w->batteries[i].recharge_min_ms = min_recharge;
+        w->batteries[i].recharge_max_ms = max_recharge;
+        w->batteries[i].recharge_done_ms = 0;
+        rng_seed(&w->batteries[i].rng, w->seed, 1 + (uint64_t)i);
+        w->batteries[i].step_timer = (Timer){ .kind = TIMER_BATTERY, .id = i };
+        w->batteries[i].recharge_timer = (Timer){ .kind = TIMER_RECHARGE, .id = i };
+        grid_add(&w->grid, GRID_BATTERIES, w->batteries[i].x, w->batteries[i].y);
+        GAME_UNLOCK(&w->batteries[i].mutex);
+    }
+
+    // Foguetes
+    pthread_mutex_init(&w->mutex_rocket_list, NULL);
+    GAME_LOCK(&w->mutex_rocket_list);
+    rocket_store_init(&w->rockets, w->config.rocket_slots);
+    GAME_UNLOCK(&w->mutex_rocket_list);
+
+    // Recursos Compartilhados
+    memset(&w->bridge, 0, sizeof(w->bridge));
+    pthread_mutex_init(&w->bridge.mutex, NULL);
+    w->bridge.capacity = w->config.battery_count ? w->config.battery_count : 1;
+    for (int d = 0; d < 2; d++) {
+        w->bridge.queue[d] = calloc(w->bridge.capacity, sizeof(int));
+        if (!w->bridge.queue[d]) { perror("calloc"); exit(1); }
+    }
+    memset(&w->depot, 0, sizeof(w->depot));
+    pthread_mutex_init(&w->depot.mutex, NULL);
+    w->depot.slots = w->config.depot_slots;
+    w->depot.policy = w->config.depot_policy;
+    w->depot.heap = calloc(w->config.battery_count ? w->config.battery_count : 1, sizeof(int));
+    if (!w->depot.heap) { perror("calloc"); exit(1); }
+
+    // Snapshots (os canais são criados depois, por quem for consumir)
+    pthread_mutex_init(&w->snapshot_mutex, NULL);
+    w->snapshot_seq = 0;
+    w->snapshot_channel_count = 0;
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&w->render_mutex, NULL);
+    pthread_cond_init(&w->render_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    w->render_kicked = false;
+
+    pthread_mutex_init(&w->input_mutex, NULL);
+    w->input_count = 0;
+    command_queue_init(&w->commands);
+}
+
+void cleanup_game_resources(World* w) {
+    pthread_mutex_destroy(&w->helicopter.mutex);
+    for (int i = 0; i < w->config.battery_count; i++) {
+        pthread_mutex_destroy(&w->batteries[i].mutex);
+    }
+    free(w->batteries);
+    free(w->soldiers);
+    w->batteries = NULL;
+    w->soldiers = NULL;
+    pthread_mutex_destroy(&w->mutex_rocket_list);
+    rocket_store_free(&w->rockets);
+    grid_free(&w->grid);
+    pthread_mutex_destroy(&w->timer_mutex);
+    free(w->due);
+    w->due = NULL;
+    pthread_mutex_destroy(&w->bridge.mutex);
+    free(w->bridge.queue[0]);
+    free(w->bridge.queue[1]);
+    pthread_mutex_destroy(&w->depot.mutex);
+    free(w->depot.heap);
+    pthread_mutex_destroy(&w->game_state.mutex);
+    for (int i = 0; i < w->snapshot_channel_count; i++) snapshot_channel_free(w->snapshot_channels[i]);
+    w->snapshot_channel_count = 0;
+    pthread_mutex_destroy(&w->snapshot_mutex);
+    pthread_cond_destroy(&w->render_cond);
+    pthread_mutex_destroy(&w->render_mutex);
+    pthread_mutex_destroy(&w->input_mutex);
+    if (w->shutdown_fd >= 0) close(w->shutdown_fd);
+    w->shutdown_fd = -1;
+    SimCommand* c;
+    while ((c = command_queue_pop(&w->commands))) free(c);
+}
+
+// --- Opções de linha de comando ---
+typedef enum { POLICY_NONE, POLICY_SCRIPT, POLICY_RANDOM, POLICY_AUTOPILOT, POLICY_KEYBOARD } PolicyKind;
+
+typedef struct ReplayData ReplayData;
+typedef struct Checkpoint Checkpoint;
+
+typedef struct {
+    bool headless;
+    int difficulty;          // 0 = perguntar no menu (ou alternar 1..3 no batch)
+    unsigned seed;
+    long max_ticks;
+    const char* script_path; // roteiro de comandos do helicóptero (headless)
+    int batch_games;         // > 0 = modo batch
+    int jobs;                // threads do batch
+    PolicyKind policy;
+    const char* report_path; // .json ou CSV
+    WorldConfig world;
+    const char* record_path; // log binário a gravar
+    const char* replay_path; // log binário a reproduzir
+    bool verify;             // confere os hashes de estado do log no replay
+    const char* trace_path;  // JSON Chrome trace da linha do tempo
+    bool actor;              // uma thread dona aplica todas as mudanças
+    bool bench_actor;        // compara o despacho compartilhado com o modo ator
+    RenderBackend render;    // saída do modo interativo
+    bool bench_render;       // compara as saídas em bytes e tempo por quadro
+    bool bench;              // suíte completa, saída JSON (em --report ou stdout)
+    const char* baseline_path; // JSON de um --bench anterior para comparar
+    double bench_tolerance;    // piora relativa aceita contra a base (fração)
+    const char* publish_name;  // anel de snapshots em memória compartilhada
+    const char* spectate_name; // lê o anel de outro processo em vez de jogar
+    const char* checkpoint_path; // grava o mundo no tick checkpoint_tick (headless)
+    long checkpoint_tick;
+    const char* restore_path;    // parte de um checkpoint em vez do tick 0 (headless e batch)
+    const ReplayData* replay; // carregado de replay_path
+    const Checkpoint* checkpoint; // mapeado de restore_path
+} Options;
+
+static void print_usage(const char* prog) {
+    fprintf(stderr,
+        "Uso: %s [opcoes]\n"
+        "  --headless          simula sem terminal, em passo fixo, o mais rapido possivel\n"
+        "  --difficulty N      1 (facil), 2 (medio) ou 3 (dificil)\n"
+        "  --seed N            semente do gerador aleatorio\n"
+        "  --ticks N           limite de ticks (de --tick-ms) no modo headless (padrao %d)\n"
+        "  --script ARQ        roteiro de comandos do helicoptero: linhas '<tick> <U|D|L|R>'\n"
+        "  --batch N           roda N partidas headless em paralelo (semente = seed + i)\n"
+        "  --jobs N            threads do batch (padrao: numero de nucleos)\n"
+        "  --policy P          none | script | random | autopilot\n"
+        "  --report ARQ        relatorio do batch (.json ou CSV)\n"
+        "  --batteries N       numero de baterias (padrao %d)\n"
+        "  --rockets N         slots de foguetes ativos (padrao %d)\n"
+        "  --soldiers N        soldados na ilha, e meta de resgate (padrao %d)\n"
+        "  --tick-ms N         resolucao do escalonador em ms (padrao %d)\n"
+        "  --physics-ms N      periodo do passo dos foguetes em ms (padrao %d; colisao continua)\n"
+        "  --depot-slots N     baterias recarregando ao mesmo tempo (padrao %d)\n"
+        "  --depot-policy P    fila do deposito: ammo (menos municao) ou wait (chegada)\n"
+        "  --map LxA           tamanho do mapa em celulas (padrao a tela, %dx%d; ate %d)\n"
+        "  --record ARQ        grava semente, configuracao e comandos num log binario\n"
+        "  --replay ARQ        reproduz um log (tempo real; com --headless, maxima velocidade)\n"
+        "  --verify            no replay, confere os hashes de estado gravados\n"
+        "  --lock-stats        mede contencao e tempo de posse dos locks (saida em stderr)\n"
+        "  --trace ARQ         grava a linha do tempo das threads em JSON (Chrome/Perfetto)\n"
+        "  --actor             uma thread dona aplica todas as mudancas (sem locks do jogo)\n"
+        "  --bench-actor       mede locks+workers contra o modo ator por --ticks, sem terminal\n"
+        "  --render B          saida do jogo: curses (padrao) ou ansi (um write() por quadro)\n"
+        "  --bench-render      mede bytes e us por quadro das duas saidas (autopilot, --ticks)\n"
+        "  --bench             suite completa (ticks, saidas, latencia, escala) em JSON; --report ARQ\n"
+        "  --baseline ARQ      compara o --bench com um JSON anterior; sai com 1 se algo piorou\n"
+        "  --tolerance PCT     piora aceita contra a base, em %% (padrao %d; latencia: o triplo)\n"
+        "  --publish NOME      publica cada snapshot num anel em memoria compartilhada (/dev/shm/NOME)\n"
+        "  --spectate NOME     assiste a um jogo publicado (com --headless, grava CSV na saida)\n"
+        "  --checkpoint ARQ    (headless) salva o mundo inteiro em ARQ no tick --checkpoint-at\n"
+        "  --checkpoint-at N   tick do checkpoint\n"
+        "  --restore ARQ       continua de um checkpoint; no batch cada partida re-semeia com a sua semente\n"
+        "  --config ARQ        arquivo 'chave = valor' com as opcoes acima (sem '--')\n",
+        prog, HEADLESS_DEFAULT_TICKS,
+        DEFAULT_BATTERIES, MAX_ROCKETS, INITIAL_SOLDIERS_AT_ORIGIN, SIM_TICK_MS, ROCKET_STEP_MS,
+        DEFAULT_DEPOT_SLOTS, SCREEN_WIDTH, SCREEN_HEIGHT, MAP_MAX_SIDE, BENCH_DEFAULT_TOLERANCE);
+}
+
+/* Aplica uma opção de tamanho do mundo; compartilhado pela linha de comando e
+   pelo arquivo de configuração. Retorna 1 se aplicou, 0 se a chave não for
+   conhecida e -1 se o valor for inválido (já reportado). */
+static int apply_world_option(Options* opt, const char* key, const char* value) {
+    if (strcmp(key, "batteries") == 0)       opt->world.battery_count = atoi(value);
+    else if (strcmp(key, "rockets") == 0)    opt->world.rocket_slots = atoi(value);
+    else if (strcmp(key, "soldiers") == 0)   opt->world.soldier_count = atoi(value);
+    else if (strcmp(key, "tick_ms") == 0)    opt->world.tick_ms = atoi(value);
+    else if (strcmp(key, "physics_ms") == 0) opt->world.physics_ms = atoi(value);
+    else if (strcmp(key, "depot_slots") == 0) opt->world.depot_slots = atoi(value);
+    else if (strcmp(key, "depot_policy") == 0) {
+        if (strcmp(value, "ammo") == 0)      opt->world.depot_policy = DEPOT_LOWEST_AMMO;
+        else if (strcmp(value, "wait") == 0) opt->world.depot_policy = DEPOT_LONGEST_WAIT;
+        else { fprintf(stderr, "Politica de deposito invalida: %s\n", value); return -1; }
+    }
+    else if (strcmp(key, "map") == 0) {
+        if (sscanf(value, "%dx%d", &opt->world.map_width, &opt->world.map_height) != 2) {
+            fprintf(stderr, "Mapa invalido (use LxA): %s\n", value);
+            return -1;
+        }
+    }
+    else if (strcmp(key, "difficulty") == 0) opt->difficulty = atoi(value);
+    else if (strcmp(key, "seed") == 0)       opt->seed = (unsigned)strtoul(value, NULL, 0);
+    else if (strcmp(key, "ticks") == 0)      opt->max_ticks = atol(value);
+    else return 0;
+    return 1;
+}
+
+/* Limites de uma configuração; vale para a linha de comando e para o que
+   vem de arquivos (checkpoints). */
+static bool world_config_valid(const WorldConfig* c) {
+    return c->battery_count >= 0 && c->battery_count <= MAX_BATTERIES &&
+           c->rocket_slots >= 1 && c->soldier_count >= 1 && c->soldier_count <= MAX_SOLDIERS &&
+           c->tick_ms >= 1 && c->tick_ms <= MAX_TICK_MS && c->depot_slots >= 1 &&
+           (c->depot_policy == DEPOT_LOWEST_AMMO || c->depot_policy == DEPOT_LONGEST_WAIT) &&
+           c->physics_ms >= 1 && c->physics_ms <= MAX_TICK_MS &&
+           c->map_width >= SCREEN_WIDTH && c->map_width <= MAP_MAX_SIDE &&
+           c->map_height >= SCREEN_HEIGHT && c->map_height <= MAP_MAX_SIDE;
+}
+
+/* Lê linhas 'chave = valor'; '#' inicia comentário. */
+static bool load_config_file(Options* opt, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) { perror(path); return false; }
+    char line[256];
+    int lineno = 0;
+    bool ok = true;
+    while (fgets(line, sizeof line, f)) {
+        lineno++;
+        char* hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char key[64], value[128];
+        if (sscanf(line, " %63[a-z_] = %127s", key, value) != 2) continue;
+        int applied = apply_world_option(opt, key, value);
+        if (applied == 0) fprintf(stderr, "%s:%d: chave desconhecida '%s'\n", path, lineno, key);
+        if (applied <= 0) ok = false;
+    }
+    fclose(f);
+    return ok;
+}
+
+bool parse_options(int argc, char** argv, Options* opt) {
+    static const struct option long_opts[] = {
+        {"headless",   no_argument,       NULL, 'H'},
+        {"difficulty", required_argument, NULL, 'd'},
+        {"seed",       required_argument, NULL, 's'},
+        {"ticks",      required_argument, NULL, 't'},
+        {"script",     required_argument, NULL, 'S'},
+        {"batch",      required_argument, NULL, 'b'},
+        {"jobs",       required_argument, NULL, 'j'},
+        {"policy",     required_argument, NULL, 'p'},
+        {"report",     required_argument, NULL, 'r'},
+        {"batteries",  required_argument, NULL, 'B'},
+        {"rockets",    required_argument, NULL, 'R'},
+        {"soldiers",   required_argument, NULL, 'O'},
+        {"tick-ms",    required_argument, NULL, 'T'},
+        {"physics-ms", required_argument, NULL, 'P'},
+        {"depot-slots", required_argument, NULL, 'K'},
+        {"depot-policy", required_argument, NULL, 'Q'},
+        {"map",        required_argument, NULL, 'M'},
+        {"record",     required_argument, NULL, 'w'},
+        {"replay",     required_argument, NULL, 'y'},
+        {"verify",     no_argument,       NULL, 'v'},
+        {"lock-stats", no_argument,       NULL, 'L'},
+        {"trace",      required_argument, NULL, 'x'},
+        {"actor",      no_argument,       NULL, 'a'},
+        {"bench-actor", no_argument,      NULL, 'A'},
+        {"render",     required_argument, NULL, 'u'},
+        {"bench-render", no_argument,     NULL, 'U'},
+        {"bench",      no_argument,       NULL, 'z'},
+        {"baseline",   required_argument, NULL, 'l'},
+        {"tolerance",  required_argument, NULL, 'o'},
+        {"publish",    required_argument, NULL, 'n'},
+        {"spectate",   required_argument, NULL, 'e'},
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"checkpoint-at", required_argument, NULL, 'i'},
+        {"restore",    required_argument, NULL, 'g'},
+        {"config",     required_argument, NULL, 'c'},
+        {"help",       no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    opt->headless = false;
+    opt->difficulty = 0;
+    opt->seed = (unsigned)time(NULL);
+    opt->max_ticks = HEADLESS_DEFAULT_TICKS;
+    opt->script_path = NULL;
+    opt->batch_games = 0;
+    opt->jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    opt->policy = POLICY_NONE;
+    opt->report_path = NULL;
+    opt->record_path = NULL;
+    opt->replay_path = NULL;
+    opt->verify = false;
+    opt->trace_path = NULL;
+    opt->actor = false;
+    opt->bench_actor = false;
+    opt->render = RENDER_CURSES;
+    opt->bench_render = false;
+    opt->bench = false;
+    opt->baseline_path = NULL;
+    opt->bench_tolerance = BENCH_DEFAULT_TOLERANCE / 100.0;
+    opt->publish_name = NULL;
+    opt->spectate_name = NULL;
+    opt->checkpoint_path = NULL;
+    opt->checkpoint_tick = 0;
+    opt->restore_path = NULL;
+    opt->checkpoint = NULL;
+    opt->replay = NULL;
+    world_config_default(&opt->world);
+    bool policy_given = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'H': opt->headless = true; break;
+            case 'd': opt->difficulty = atoi(optarg); break;
+            case 's': opt->seed = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 't': opt->max_ticks = atol(optarg); break;
+            case 'S': opt->script_path = optarg; break;
+            case 'b': opt->batch_games = atoi(optarg); break;
+            case 'j': opt->jobs = atoi(optarg); break;
+            case 'r': opt->report_path = optarg; break;
+            case 'B': apply_world_option(opt, "batteries", optarg); break;
+            case 'R': apply_world_option(opt, "rockets", optarg); break;
+            case 'O': apply_world_option(opt, "soldiers", optarg); break;
+            case 'T': apply_world_option(opt, "tick_ms", optarg); break;
+            case 'P': apply_world_option(opt, "physics_ms", optarg); break;
+            case 'K': apply_world_option(opt, "depot_slots", optarg); break;
+            case 'Q': if (apply_world_option(opt, "depot_policy", optarg) < 0) return false; break;
+            case 'M': if (apply_world_option(opt, "map", optarg) < 0) return false; break;
+            case 'c': if (!load_config_file(opt, optarg)) return false; break;
+            case 'w': opt->record_path = optarg; break;
+            case 'y': opt->replay_path = optarg; break;
+            case 'v': opt->verify = true; break;
+            case 'L': lock_stats_enabled = true; break;
+            case 'x': opt->trace_path = optarg; break;
+            case 'a': opt->actor = true; break;
+            case 'A': opt->bench_actor = true; break;
+            case 'U': opt->bench_render = true; break;
+            case 'z': opt->bench = true; break;
+            case 'l': opt->baseline_path = optarg; break;
+            case 'o': opt->bench_tolerance = atof(optarg) / 100.0; break;
+            case 'n': opt->publish_name = optarg; break;
+            case 'e': opt->spectate_name = optarg; break;
+            case 'k': opt->checkpoint_path = optarg; break;
+            case 'i': opt->checkpoint_tick = atol(optarg); break;
+            case 'g': opt->restore_path = optarg; break;
+            case 'u':
+                if (strcmp(optarg, "curses") == 0)    opt->render = RENDER_CURSES;
+                else if (strcmp(optarg, "ansi") == 0) opt->render = RENDER_ANSI;
+                else { fprintf(stderr, "Saida invalida: %s\n", optarg); return false; }
+                break;
+            case 'p':
+                policy_given = true;
+                if (strcmp(optarg, "none") == 0)           opt->policy = POLICY_NONE;
+                else if (strcmp(optarg, "script") == 0)    opt->policy = POLICY_SCRIPT;
+                else if (strcmp(optarg, "random") == 0)    opt->policy = POLICY_RANDOM;
+                else if (strcmp(optarg, "autopilot") == 0) opt->policy = POLICY_AUTOPILOT;
+                else { fprintf(stderr, "Politica invalida: %s\n", optarg); return false; }
+                break;
+            default:  print_usage(argv[0]); return false;
+        }
+    }
+    if (!policy_given) {
+        if (opt->script_path)          opt->policy = POLICY_SCRIPT;
+        else if (opt->batch_games > 0) opt->policy = POLICY_RANDOM;
+    }
+    if (opt->policy == POLICY_SCRIPT && !opt->script_path) {
+        fprintf(stderr, "--policy script exige --script\n");
+        return false;
+    }
+    if (opt->jobs < 1) opt->jobs = 1;
+    if ((opt->record_path || opt->replay_path) && opt->batch_games > 0) {
+        fprintf(stderr, "--record/--replay nao se aplicam ao batch\n");
+        return false;
+    }
+    if (opt->publish_name && (opt->batch_games > 0 || opt->bench_actor || opt->bench_render || opt->bench ||
+                              opt->spectate_name)) {
+        fprintf(stderr, "--publish so vale para uma partida (interativa ou --headless)\n");
+        return false;
+    }
+    if ((opt->checkpoint_path || opt->restore_path) && (opt->record_path || opt->replay_path)) {
+        fprintf(stderr, "--checkpoint/--restore nao se combinam com --record/--replay\n");
+        return false;
+    }
+    if (opt->checkpoint_path && (!opt->headless || opt->batch_games > 0 || opt->checkpoint_tick <= 0)) {
+        fprintf(stderr, "--checkpoint exige --headless e --checkpoint-at > 0\n");
+        return false;
+    }
+    if (opt->restore_path && !opt->headless && opt->batch_games == 0) {
+        fprintf(stderr, "--restore vale para --headless ou --batch\n");
+        return false;
+    }
+    if (opt->baseline_path && !opt->bench) {
+        fprintf(stderr, "--baseline exige --bench\n");
+        return false;
+    }
+    if (opt->bench_tolerance <= 0) {
+        fprintf(stderr, "--tolerance deve ser > 0\n");
+        return false;
+    }
+    if ((opt->record_path && opt->replay_path) || (opt->verify && !opt->replay_path)) {
+        fprintf(stderr, "Use --record ou --replay (e --verify so com --replay)\n");
+        return false;
+    }
+    if (!world_config_valid(&opt->world)) {
+        fprintf(stderr, "Configuracao invalida: baterias 0..%d, foguetes >= 1, soldados 1..%d, tick e fisica 1..%d ms, "
+                "deposito >= 1 vaga, mapa de %dx%d a %dx%d\n", MAX_BATTERIES, MAX_SOLDIERS, MAX_TICK_MS,
+                SCREEN_WIDTH, SCREEN_HEIGHT, MAP_MAX_SIDE, MAP_MAX_SIDE);
+        return false;
+    }
+    if (opt->difficulty < 0 || opt->difficulty > 3) {
+        fprintf(stderr, "Dificuldade invalida: %d\n", opt->difficulty);
+        return false;
+    }
+    if (opt->headless && opt->batch_games == 0 && opt->difficulty == 0) opt->difficulty = 1;
+    return true;
+}
+
+// --- Roteiro de entrada (modo headless) ---
+typedef struct {
+    long tick;
+    HeliCommand cmd;
+} ScriptEvent;
+
+typedef struct {
+    ScriptEvent* events;
+    int count;
+    int next;
+} InputScript;
+
+HeliCommand command_from_char(char c) {
+    switch (c) {
+        case 'U': case 'u': return CMD_UP;
+        case 'D': case 'd': return CMD_DOWN;
+        case 'L': case 'l': return CMD_LEFT;
+        case 'R': case 'r': return CMD_RIGHT;
+        default: return CMD_NONE;
+    }
+}
+
+/* Lê linhas '<tick> <U|D|L|R>' (ticks do escalonador, em ordem crescente).
+   Linhas vazias ou iniciadas por '#' são ignoradas. */
+bool input_script_load(InputScript* sc, const char* path) {
+    sc->events = NULL;
+    sc->count = 0;
+    sc->next = 0;
+    if (!path) return true;
+
+    FILE* f = fopen(path, "r");
+    if (!f) { perror(path); return false; }
+    int cap = 0;
+    char line[128];
+    while (fgets(line, sizeof line, f)) {
+        long tick;
+        char c;
+        if (line[0] == '#' || sscanf(line, "%ld %c", &tick, &c) != 2) continue;
+        HeliCommand cmd = command_from_char(c);
+        if (cmd == CMD_NONE) continue;
+        if (sc->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            sc->events = realloc(sc->events, cap * sizeof(ScriptEvent));
+            if (!sc->events) { perror("realloc"); exit(1); }
+        }
+        sc->events[sc->count].tick = tick;
+        sc->events[sc->count].cmd = cmd;
+        sc->count++;
+    }
+    fclose(f);
+    return true;
+}
+
+/* Próximo comando já vencido no tick atual (um por passo do helicóptero,
+   como o flushinp() do modo interativo). */
+HeliCommand input_script_next(InputScript* sc, long tick) {
+    if (sc->next < sc->count && sc->events[sc->next].tick <= tick) {
+        return sc->events[sc->next++].cmd;
+    }
+    return CMD_NONE;
+}
+
+// --- Gravação e replay (log binário) ---
+/* Formato (inteiros little-endian):
+     cabeçalho: "HGRP", versão u8, semente u64, dificuldade u8 e
+                baterias, foguetes, soldados, tick_ms, vagas e política
+                do depósito, physics_ms e largura e altura do mapa como u32;
+     registros: tipo u8, delta de tick em varint (LEB128) e carga:
+                REC_INPUT -> comando u8; REC_HASH e REC_END -> hash u64.
+   Só entram os comandos (com o tick do passo do helicóptero) e um hash a
+   cada REPLAY_HASH_EVERY passos: o resto sai da semente e da configuração. */
+typedef enum { REC_INPUT = 1, REC_HASH = 2, REC_END = 3 } ReplayRecordType;
+
+typedef struct {
+    long tick;
+    uint64_t hash;
+} ReplayHash;
+
+struct ReplayData {
+    uint64_t seed;
+    int difficulty;
+    WorldConfig config;
+    InputScript script;
+    ReplayHash* hashes;
+    int hash_count;
+    long end_tick;       // -1 se o log foi truncado
+    uint64_t end_hash;
+};
+
+/* Estado de gravação/verificação de uma partida em andamento. */
+typedef struct {
+    FILE* out;                // NULL = não grava
+    long last_tick;           // base do próximo delta
+    long steps;               // passos do helicóptero já vistos
+    const ReplayData* check;  // NULL = não verifica
+    int check_next;
+    int checked;
+    long mismatch_tick;       // primeiro tick divergente, -1 = nenhum
+} ReplayLog;
+
+static void put_le(FILE* f, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) fputc((int)(v >> (8 * i)) & 0xFF, f);
+}
+
+static bool get_le(FILE* f, uint64_t* v, int bytes) {
+    *v = 0;
+    for (int i = 0; i < bytes; i++) {
+        int c = fgetc(f);
+        if (c == EOF) return false;
+        *v |= (uint64_t)c << (8 * i);
+    }
+    return true;
+}
+
+static void put_varint(FILE* f, uint64_t v) {
+    while (v >= 0x80) {
+        fputc((int)(v & 0x7F) | 0x80, f);
+        v >>= 7;
+    }
+    fputc((int)v, f);
+}
+
+static bool get_varint(FILE* f, uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(f);
+        if (c == EOF) return false;
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t v) {
+    return (h ^ v) * 0x100000001b3ULL;
+}
+
+/* Hash do estado simulado (posições, munição, estados, foguetes). Chamar
+   da thread que despacha os timers, entre dois despachos. */
+uint64_t world_state_hash(World* w) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = hash_mix(h, (uint64_t)w->helicopter.x << 32 | (uint32_t)w->helicopter.y);
+    h = hash_mix(h, (uint64_t)w->helicopter.soldiers_on_board << 32 | (uint32_t)w->helicopter.soldiers_rescued_total);
+    h = hash_mix(h, w->helicopter.status);
+    h = hash_mix(h, (uint64_t)w->game_state.soldiers_at_origin_count);
+    for (int i = 0; i < w->config.battery_count; i++) {
+        const Battery* b = &w->batteries[i];
+        h = hash_mix(h, (uint64_t)b->x << 32 | (uint32_t)b->y);
+        h = hash_mix(h, (uint64_t)b->ammo << 32 | (uint32_t)b->status);
+    }
+    for (int i = rocket_store_next(&w->rockets, 0); i >= 0; i = rocket_store_next(&w->rockets, i + 1)) {
+        h = hash_mix(h, (uint64_t)i << 40 ^ (uint64_t)w->rockets.x[i] << 20 ^ (uint64_t)(uint32_t)w->rockets.y[i]);
+    }
+    return h;
+}
+
+static void replay_put_record(ReplayLog* log, ReplayRecordType type, long tick) {
+    fputc(type, log->out);
+    put_varint(log->out, (uint64_t)(tick - log->last_tick));
+    log->last_tick = tick;
+}
+
+bool replay_open_record(ReplayLog* log, const char* path, const World* w) {
+    memset(log, 0, sizeof(*log));
+    log->mismatch_tick = -1;
+    if (!path) return true;
+    log->out = fopen(path, "wb");
+    if (!log->out) { perror(path); return false; }
+    fwrite("HGRP", 1, 4, log->out);
+    put_le(log->out, REPLAY_VERSION, 1);
+    put_le(log->out, w->seed, 8);
+    put_le(log->out, (uint64_t)w->difficulty, 1);
+    put_le(log->out, (uint64_t)w->config.battery_count, 4);
+    put_le(log->out, (uint64_t)w->config.rocket_slots, 4);
+    put_le(log->out, (uint64_t)w->config.soldier_count, 4);
+    put_le(log->out, (uint64_t)w->config.tick_ms, 4);
+    put_le(log->out, (uint64_t)w->config.depot_slots, 4);
+    put_le(log->out, (uint64_t)w->config.depot_policy, 4);
+    put_le(log->out, (uint64_t)w->config.physics_ms, 4);
+    put_le(log->out, (uint64_t)w->config.map_width, 4);
+    put_le(log->out, (uint64_t)w->config.map_height, 4);
+    return true;
+}
+
+/* Chamado depois de cada passo do helicóptero: grava o comando e, a cada
+   REPLAY_HASH_EVERY passos, o hash; no replay com --verify, confere. */
+void replay_log_step(ReplayLog* log, World* w, long tick, HeliCommand cmd) {
+    bool hash_step = ++log->steps % REPLAY_HASH_EVERY == 0;
+    if (log->out) {
+        if (cmd != CMD_NONE) {
+            replay_put_record(log, REC_INPUT, tick);
+            fputc(cmd, log->out);
+        }
+        if (hash_step) {
+            replay_put_record(log, REC_HASH, tick);
+            put_le(log->out, world_state_hash(w), 8);
+        }
+    }
+    if (log->check && hash_step && log->check_next < log->check->hash_count &&
+        log->check->hashes[log->check_next].tick == tick) {
+        if (log->check->hashes[log->check_next].hash != world_state_hash(w) && log->mismatch_tick < 0) {
+            log->mismatch_tick = tick;
+        }
+        log->check_next++;
+        log->checked++;
+    }
+}
+
+/* Fecha o log: grava (ou confere) o tick final e o hash final. */
+void replay_log_finish(ReplayLog* log, World* w, long end_tick) {
+    uint64_t h = world_state_hash(w);
+    if (log->out) {
+        replay_put_record(log, REC_END, end_tick);
+        put_le(log->out, h, 8);
+        if (fclose(log->out) != 0) perror("fclose");
+        log->out = NULL;
+    }
+    if (log->check && log->check->end_tick >= 0) {
+        if ((log->check->end_tick != end_tick || log->check->end_hash != h) && log->mismatch_tick < 0) {
+            log->mismatch_tick = end_tick;
+        }
+        log->checked++;
+    }
+}
+
+void replay_data_free(ReplayData* rd) {
+    free(rd->script.events);
+    free(rd->hashes);
+}
+
+/* Carrega um log e aplica semente, dificuldade e configuração em opt. */
+bool replay_load(ReplayData* rd, Options* opt) {
+    memset(rd, 0, sizeof(*rd));
+    rd->end_tick = -1;
+    FILE* f = fopen(opt->replay_path, "rb");
+    if (!f) { perror(opt->replay_path); return false; }
+    char magic[4];
+    uint64_t v[11];
+    bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, "HGRP", 4) == 0 &&
+              get_le(f, &v[0], 1) && v[0] == REPLAY_VERSION &&
+              get_le(f, &rd->seed, 8) && get_le(f, &v[1], 1);
+    for (int i = 2; ok && i < 11; i++) ok = get_le(f, &v[i], 4);
+    if (ok) {
+        rd->difficulty = (int)v[1];
+        rd->config.battery_count = (int)v[2];
+        rd->config.rocket_slots = (int)v[3];
+        rd->config.soldier_count = (int)v[4];
+        rd->config.tick_ms = (int)v[5];
+        rd->config.depot_slots = (int)v[6];
+        rd->config.depot_policy = (DepotPolicy)v[7];
+        rd->config.physics_ms = (int)v[8];
+        rd->config.map_width = (int)v[9];
+        rd->config.map_height = (int)v[10];
+        // o log vem de fora: mesmos limites da linha de comando
+        ok = world_config_valid(&rd->config) && rd->difficulty >= 1 && rd->difficulty <= 3;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: cabecalho de replay invalido\n", opt->replay_path);
+        fclose(f);
+        return false;
+    }
+
+    int event_cap = 0, hash_cap = 0;
+    long tick = 0;
+    int type;
+    bool corrupt = false;
+    while ((type = fgetc(f)) != EOF) {
+        uint64_t delta, payload;
+        if (!get_varint(f, &delta)) break;
+        tick += (long)delta;
+        if (type == REC_INPUT) {
+            int cmd = fgetc(f);
+            if (cmd == EOF) break;
+            if (cmd < CMD_NONE || cmd > CMD_RIGHT) { corrupt = true; break; }
+            if (rd->script.count == event_cap) {
+                event_cap = event_cap ? event_cap * 2 : 64;
+                rd->script.events = realloc(rd->script.events, event_cap * sizeof(ScriptEvent));
+                if (!rd->script.events) { perror("realloc"); exit(1); }
+            }
+            rd->script.events[rd->script.count].tick = tick;
+            rd->script.events[rd->script.count].cmd = (HeliCommand)cmd;
+            rd->script.count++;
+        } else if (type == REC_HASH || type == REC_END) {
+            if (!get_le(f, &payload, 8)) break;
+            if (type == REC_END) {
+                rd->end_tick = tick;
+                rd->end_hash = payload;
+                break;
+            }
+            if (rd->hash_count == hash_cap) {
+                hash_cap = hash_cap ? hash_cap * 2 : 64;
+                rd->hashes = realloc(rd->hashes, hash_cap * sizeof(ReplayHash));
+                if (!rd->hashes) { perror("realloc"); exit(1); }
+            }
+            rd->hashes[rd->hash_count].tick = tick;
+            rd->hashes[rd->hash_count].hash = payload;
+            rd->hash_count++;
+        } else {
+            break;
+        }
+    }
+    fclose(f);
+    if (corrupt) {
+        fprintf(stderr, "%s: registro de replay corrompido (comando invalido)\n", opt->replay_path);
+        replay_data_free(rd);
+        return false;
+    }
+    if (rd->end_tick < 0) fprintf(stderr, "%s: log sem fim (truncado?); reproduzindo o que houver\n", opt->replay_path);
+
+    opt->seed = (unsigned)rd->seed;
+    opt->difficulty = rd->difficulty;
+    opt->world = rd->config;
+    opt->policy = POLICY_SCRIPT;
+    if (rd->end_tick >= 0) opt->max_ticks = rd->end_tick;
+    opt->replay = rd;
+    return true;
+}
+
+/* Resultado da verificação; retorna o código de saída (0 ou 3). */
+int replay_report(const ReplayLog* log) {
+    if (!log->check) return 0;
+    if (log->mismatch_tick >= 0) {
+        printf("Verificacao: DIVERGENCIA no tick %ld\n", log->mismatch_tick);
+        return 3;
+    }
+    printf("Verificacao: OK (%d hashes conferidos)\n", log->checked);
+    return 0;
+}
+
+// --- Políticas do helicóptero ---
+typedef struct HeliPolicy {
+    PolicyKind kind;
+    InputScript script;  // eventos compartilhados (somente leitura), cursor próprio
+    Rng rng;
+    World* world;        // POLICY_KEYBOARD lê a fila de teclas do mundo
+    ReplayLog* log;      // NULL = sem gravação/verificação
+    void (*observer)(World* w, void* ctx); // chamado depois de cada passo (benchmarks)
+    void* observer_ctx;
+} HeliPolicy;
+
+/* Próxima tecla guardada pela thread de teclado no modo determinístico. */
+static HeliCommand keyboard_next(World* w) {
+    HeliCommand cmd = CMD_NONE;
+    GAME_LOCK(&w->input_mutex);
+    if (w->input_count > 0) {
+        cmd = w->input_queue[0];
+        memmove(w->input_queue, w->input_queue + 1, --w->input_count * sizeof(HeliCommand));
+    }
+    GAME_UNLOCK(&w->input_mutex);
+    return cmd;
+}
+
+static HeliCommand step_toward(int from, int to, HeliCommand dec, HeliCommand inc) {
+    if (from == to) return CMD_NONE;
+    return (to < from) ? dec : inc;
+}
+
+/* Rota fixa: sobe até a altitude de cruzeiro, atravessa e desce no alvo.
+   O alvo é a origem enquanto houver espaço e soldados, senão a plataforma. */
+static HeliCommand autopilot_next(World* w) {
+    GAME_LOCK(&w->helicopter.mutex);
+    int x = w->helicopter.x, y = w->helicopter.y;
+    int on_board = w->helicopter.soldiers_on_board;
+    GAME_UNLOCK(&w->helicopter.mutex);
+    GAME_LOCK(&w->game_state.mutex);
+    int at_origin = w->game_state.soldiers_at_origin_count;
+    GAME_UNLOCK(&w->game_state.mutex);
+
+    bool fetch = on_board < HELICOPTER_CAPACITY && at_origin > 0;
+    int goal_x = fetch ? ORIGIN_X : PLATFORM_X;
+    int goal_y = fetch ? ORIGIN_Y : PLATFORM_Y;
+
+    if (x == goal_x) return step_toward(y, goal_y, CMD_UP, CMD_DOWN);
+    if (y != AUTOPILOT_CRUISE_Y) return step_toward(y, AUTOPILOT_CRUISE_Y, CMD_UP, CMD_DOWN);
+    return step_toward(x, goal_x, CMD_LEFT, CMD_RIGHT);
+}
+
+HeliCommand policy_next(HeliPolicy* p, World* w, long tick) {
+    switch (p->kind) {
+        case POLICY_SCRIPT:    return input_script_next(&p->script, tick);
+        case POLICY_RANDOM:    return (HeliCommand)rng_below(&p->rng, 5);
+        case POLICY_AUTOPILOT: return autopilot_next(w);
+        case POLICY_KEYBOARD:  return keyboard_next(w);
+        default:               return CMD_NONE;
+    }
+}
+
+/* Passo do helicóptero guiado por política, com gravação/verificação.
+   Rearma o timer e retorna false se o jogo acabou. */
+bool world_helicopter_tick(World* w, HeliPolicy* p, Timer* t) {
+    uint64_t start = trace_begin();
+    HeliCommand cmd = policy_next(p, w, (long)t->expires);
+    bool alive = helicopter_step(w, cmd);
+    trace_span("passo", "helicoptero", start, "cmd", cmd);
+    if (p->log) replay_log_step(p->log, w, (long)t->expires, cmd);
+    if (p->observer) p->observer(w, p->observer_ctx);
+    if (alive) world_arm_timer(w, t, t->expires + world_period_ticks(w, HELICOPTER_STEP_MS));
+    return alive;
+}
+
+/* Executa a mesma lógica do modo interativo numa única thread e sem
+   terminal: o relógio lógico salta direto para o próximo tick com timers e
+   os vencidos são despachados em ordem fixa (tipo, id), então a partida é
+   determinística. Avança a partir do estado atual da roda até o tick
+   max_ticks (absoluto) ou o fim do jogo e retorna onde parou; parar e
+   continuar depois dá o mesmo resultado que rodar direto. */
+long world_run_ticks(World* w, HeliPolicy* policy, long max_ticks) {
+    while (w->running) {
+        uint64_t tick = wheel_next_tick(&w->timers, (uint64_t)max_ticks);
+        if (tick >= (uint64_t)max_ticks) return max_ticks;
+        w->timers.now = tick;
+        w->clock_ms = (long)tick * w->config.tick_ms;
+        world_collect_due(w);
+        uint64_t start = trace_begin();
+        for (int i = 0; i < w->due_count; i++) {
+            Timer* t = w->due[i];
+            if (t->kind != TIMER_HELICOPTER) {
+                timer_fire(w, t);
+            } else if (!world_helicopter_tick(w, policy, t)) {
+                world_publish_snapshot(w);
+                return (long)tick + 1;
+            }
+        }
+        world_publish_snapshot(w); // só custa algo com canais ou --publish
+        trace_span("tick", "tick", start, "timers", w->due_count);
+    }
+    return (long)w->timers.now;
+}
+
+// Partida nova: arma os timers no tick 0 e roda
+long world_run_headless(World* w, HeliPolicy* policy, long max_ticks) {
+    world_start_timers(w, true);
+    return world_run_ticks(w, policy, max_ticks);
+}
+
+// --- Checkpoints (--checkpoint / --restore) ---
+/* Arquivo binário de layout fixo, na ordem de bytes da máquina (não serve
+   para trocar entre arquiteturas): um CheckpointHeader com o estado
+   escalar e, nos deslocamentos gravados nele, os vetores do mundo.
+   Carregar é mmap, conferir cabeçalho, tamanhos, deslocamentos e checksum,
+   e copiar; nada é interpretado campo a campo. A grade de ocupação não vai
+   no arquivo: é refeita a partir das posições. */
+#define CHECKPOINT_MAGIC "HGCK"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_DISARMED UINT64_MAX // timer fora da roda
+
+typedef struct {
+    int32_t x, y, combat_x, combat_y;
+    int32_t ammo, max_ammo, status, bridge_granted;
+    int64_t recharge_min_ms, recharge_max_ms, recharge_done_ms;
+    int64_t bridge_wait_since_ms, depot_wait_since_ms;
+    uint64_t depot_ticket;
+    uint64_t step_expires, recharge_expires;
+    uint32_t rng[4];
+    int32_t rockets_fired, recharges;
+} CheckpointBattery;
+
+typedef struct {
+    int32_t x, y, active;
+} CheckpointSoldier;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t header_bytes, battery_bytes; // sizeof dos registros: pega mudança de layout sem versão nova
+    uint64_t file_bytes;
+    uint64_t checksum;                    // FNV-1a de tudo depois do cabeçalho
+
+    int32_t battery_count, rocket_slots, rocket_capacity, soldier_count;
+    int32_t tick_ms, physics_ms, depot_slots, depot_policy;
+    int32_t map_width, map_height, difficulty, bridge_capacity;
+    uint64_t seed;
+
+    uint64_t tick; // próximo tick da roda
+    int64_t clock_ms, last_board_ms, end_ms;
+    uint64_t rockets_expires, helicopter_expires;
+
+    int32_t heli_x, heli_y, heli_on_board, heli_rescued, heli_status;
+    int32_t game_over, victory, soldiers_at_origin;
+
+    int32_t bridge_direction, bridge_on_bridge, bridge_batch, bridge_max_queue;
+    int32_t bridge_head[2], bridge_waiting[2];
+    int64_t bridge_crossings, bridge_waits, bridge_total_wait_ms, bridge_max_wait_ms;
+
+    int32_t depot_busy, depot_waiting, depot_max_queue, rocket_free_top;
+    uint64_t depot_next_ticket;
+    int64_t depot_admissions, depot_waits, depot_total_wait_ms, depot_max_wait_ms;
+
+    uint32_t policy_rng[4];
+    int64_t policy_script_next;
+
+    // Deslocamentos das seções, em bytes desde o início do arquivo
+    uint64_t off_batteries, off_soldiers, off_bridge_queue, off_depot_heap;
+    uint64_t off_rocket_px, off_rocket_py, off_rocket_dx, off_rocket_dy;
+    uint64_t off_rocket_x, off_rocket_y, off_rocket_mask, off_rocket_owner, off_rocket_free;
+} CheckpointHeader;
+
+struct Checkpoint {
+    const CheckpointHeader* h; // mapeamento somente leitura do arquivo inteiro
+    size_t bytes;
+};
+
+/* Preenche os deslocamentos e file_bytes a partir das contagens do
+   cabeçalho. Quem grava e quem lê chamam a mesma função. */
+static void checkpoint_layout(CheckpointHeader* h) {
+    uint64_t off = sizeof(CheckpointHeader);
+    #define CK_SECTION(field, count, elem) \
+        (off = (off + 63) & ~(uint64_t)63, h->field = off, off += (uint64_t)(count) * (elem))
+    CK_SECTION(off_batteries, h->battery_count, sizeof(CheckpointBattery));
+    CK_SECTION(off_soldiers, h->soldier_count, sizeof(CheckpointSoldier));
+    CK_SECTION(off_bridge_queue, 2 * h->bridge_capacity, sizeof(int32_t));
+    CK_SECTION(off_depot_heap, h->battery_count, sizeof(int32_t));
+    CK_SECTION(off_rocket_px, h->rocket_capacity, sizeof(float));
+    CK_SECTION(off_rocket_py, h->rocket_capacity, sizeof(float));
+    CK_SECTION(off_rocket_dx, h->rocket_capacity, sizeof(float));
+    CK_SECTION(off_rocket_dy, h->rocket_capacity, sizeof(float));
+    CK_SECTION(off_rocket_x, h->rocket_capacity, sizeof(int32_t));
+    CK_SECTION(off_rocket_y, h->rocket_capacity, sizeof(int32_t));
+    CK_SECTION(off_rocket_mask, h->rocket_capacity / 64, sizeof(uint64_t));
+    CK_SECTION(off_rocket_owner, h->rocket_capacity, sizeof(int32_t));
+    CK_SECTION(off_rocket_free, h->rocket_capacity, sizeof(int32_t));
+    #undef CK_SECTION
+    h->file_bytes = off;
+}
+
+static uint64_t checkpoint_checksum(const void* base, uint64_t bytes) {
+    const unsigned char* p = (const unsigned char*)base + sizeof(CheckpointHeader);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint64_t i = sizeof(CheckpointHeader); i < bytes; i++) h = (h ^ *p++) * 0x100000001b3ULL;
+    return h;
+}
+
+static void rng_export(const Rng* r, uint32_t out[4]) { memcpy(out, r->s, sizeof r->s); }
+static void rng_import(Rng* r, const uint32_t in[4]) { memcpy(r->s, in, sizeof r->s); }
+
+/* Grava o mundo entre dois ticks (da thread que despacha os timers). A
+   política entra junto: gerador da random e cursor do roteiro. */
+bool checkpoint_save(World* w, const HeliPolicy* p, const char* path) {
+    CheckpointHeader hdr = {
+        .magic = CHECKPOINT_MAGIC, .version = CHECKPOINT_VERSION,
+        .header_bytes = sizeof(CheckpointHeader), .battery_bytes = sizeof(CheckpointBattery),
+        .battery_count = w->config.battery_count, .rocket_slots = w->rockets.limit,
+        .rocket_capacity = w->rockets.capacity, .soldier_count = w->config.soldier_count,
+        .tick_ms = w->config.tick_ms, .physics_ms = w->config.physics_ms,
+        .depot_slots = w->config.depot_slots, .depot_policy = w->config.depot_policy,
+        .map_width = w->config.map_width, .map_height = w->config.map_height,
+        .difficulty = w->difficulty, .bridge_capacity = w->bridge.capacity, .seed = w->seed,
+        .tick = w->timers.now, .clock_ms = w->clock_ms, .last_board_ms = w->last_board_ms,
+        .end_ms = w->stats.end_ms,
+        .rockets_expires = CHECKPOINT_DISARMED, .helicopter_expires = CHECKPOINT_DISARMED,
+        .heli_x = w->helicopter.x, .heli_y = w->helicopter.y,
+        .heli_on_board = w->helicopter.soldiers_on_board,
+        .heli_rescued = w->helicopter.soldiers_rescued_total, .heli_status = w->helicopter.status,
+        .game_over = w->game_state.game_over_flag, .victory = w->game_state.victory_flag,
+        .soldiers_at_origin = w->game_state.soldiers_at_origin_count,
+        .bridge_direction = w->bridge.direction, .bridge_on_bridge = w->bridge.on_bridge,
+        .bridge_batch = w->bridge.batch, .bridge_max_queue = w->bridge.max_queue,
+        .bridge_head = { w->bridge.head[0], w->bridge.head[1] },
+        .bridge_waiting = { w->bridge.waiting[0], w->bridge.waiting[1] },
+        .bridge_crossings = w->bridge.crossings, .bridge_waits = w->bridge.waits,
+        .bridge_total_wait_ms = w->bridge.total_wait_ms, .bridge_max_wait_ms = w->bridge.max_wait_ms,
+        .depot_busy = w->depot.busy, .depot_waiting = w->depot.waiting,
+        .depot_max_queue = w->depot.max_queue, .rocket_free_top = w->rockets.free_top,
+        .depot_next_ticket = w->depot.next_ticket, .depot_admissions = w->depot.admissions,
+        .depot_waits = w->depot.waits, .depot_total_wait_ms = w->depot.total_wait_ms,
+        .depot_max_wait_ms = w->depot.max_wait_ms,
+        .policy_script_next = p->script.next,
+    };
+    rng_export(&p->rng, hdr.policy_rng);
+    checkpoint_layout(&hdr);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror(path); return false; }
+    if (ftruncate(fd, (off_t)hdr.file_bytes) < 0) { perror("ftruncate"); close(fd); return false; }
+    char* base = mmap(NULL, hdr.file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { perror("mmap"); return false; }
+
+    // Prazos dos timers armados: quem não está na roda fica DISARMED
+    CheckpointBattery* cb = (CheckpointBattery*)(base + hdr.off_batteries);
+    for (int i = 0; i < w->config.battery_count; i++) {
+        cb[i].step_expires = cb[i].recharge_expires = CHECKPOINT_DISARMED;
+    }
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            for (const Timer* t = w->timers.slots[level][slot]; t; t = t->next) {
+                switch (t->kind) {
+                    case TIMER_ROCKETS:    hdr.rockets_expires = t->expires; break;
+                    case TIMER_HELICOPTER: hdr.helicopter_expires = t->expires; break;
+                    case TIMER_BATTERY:    cb[t->id].step_expires = t->expires; break;
+                    case TIMER_RECHARGE:   cb[t->id].recharge_expires = t->expires; break;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < w->config.battery_count; i++) {
+        const Battery* b = &w->batteries[i];
+        CheckpointBattery* c = &cb[i];
+        c->x = b->x; c->y = b->y; c->combat_x = b->combat_x; c->combat_y = b->combat_y;
+        c->ammo = b->ammo; c->max_ammo = b->max_ammo; c->status = b->status;
+        c->bridge_granted = b->bridge_granted;
+        c->recharge_min_ms = b->recharge_min_ms; c->recharge_max_ms = b->recharge_max_ms;
+        c->recharge_done_ms = b->recharge_done_ms;
+        c->bridge_wait_since_ms = b->bridge_wait_since_ms; c->depot_wait_since_ms = b->depot_wait_since_ms;
+        c->depot_ticket = b->depot_ticket;
+        rng_export(&b->rng, c->rng);
+        c->rockets_fired = b->rockets_fired; c->recharges = b->recharges;
+    }
+    CheckpointSoldier* cs = (CheckpointSoldier*)(base + hdr.off_soldiers);
+    for (int i = 0; i < w->config.soldier_count; i++) {
+        cs[i] = (CheckpointSoldier){ w->soldiers[i].x, w->soldiers[i].y, w->soldiers[i].active };
+    }
+    memcpy(base + hdr.off_bridge_queue, w->bridge.queue[0], hdr.bridge_capacity * sizeof(int32_t));
+    memcpy(base + hdr.off_bridge_queue + hdr.bridge_capacity * sizeof(int32_t), w->bridge.queue[1],
+           hdr.bridge_capacity * sizeof(int32_t));
+    memcpy(base + hdr.off_depot_heap, w->depot.heap, hdr.battery_count * sizeof(int32_t));
+    const RocketStore* rs = &w->rockets;
+    size_t n = rs->capacity;
+    memcpy(base + hdr.off_rocket_px, rs->px, n * sizeof(float));
+    memcpy(base + hdr.off_rocket_py, rs->py, n * sizeof(float));
+    memcpy(base + hdr.off_rocket_dx, rs->dx, n * sizeof(float));
+    memcpy(base + hdr.off_rocket_dy, rs->dy, n * sizeof(float));
+    memcpy(base + hdr.off_rocket_x, rs->x, n * sizeof(int32_t));
+    memcpy(base + hdr.off_rocket_y, rs->y, n * sizeof(int32_t));
+    memcpy(base + hdr.off_rocket_mask, rs->active_mask, n / 64 * sizeof(uint64_t));
+    memcpy(base + hdr.off_rocket_owner, rs->owner_battery_id, n * sizeof(int32_t));
+    memcpy(base + hdr.off_rocket_free, rs->free_slots, n * sizeof(int32_t));
+
+    hdr.checksum = checkpoint_checksum(base, hdr.file_bytes);
+    memcpy(base, &hdr, sizeof hdr);
+    bool ok = munmap(base, hdr.file_bytes) == 0;
+    if (!ok) perror("munmap");
+    return ok;
+}
+
+void checkpoint_close(Checkpoint* ck) {
+    if (ck->h) munmap((void*)ck->h, ck->bytes);
+    ck->h = NULL;
+}
+
+static WorldConfig checkpoint_config(const CheckpointHeader* h) {
+    return (WorldConfig){
+        .battery_count = h->battery_count, .rocket_slots = h->rocket_slots,
+        .soldier_count = h->soldier_count, .tick_ms = h->tick_ms, .physics_ms = h->physics_ms,
+        .depot_slots = h->depot_slots, .depot_policy = (DepotPolicy)h->depot_policy,
+        .map_width = h->map_width, .map_height = h->map_height,
+    };
+}
+
+static bool checkpoint_in_map(const CheckpointHeader* h, int x, int y) {
+    return x >= 0 && x < h->map_width && y >= 0 && y < h->map_height;
+}
+
+static bool checkpoint_battery_id(const CheckpointHeader* h, int32_t id) {
+    return id >= 0 && id < h->battery_count;
+}
+
+/* Confere os valores (não só o layout): o checksum pega corrupção, mas um
+   arquivo de outra versão do programa ou editado e re-somado pode trazer
+   configuração fora dos limites, enums inválidos ou índices fora dos
+   vetores, que o world_restore usaria sem checar. */
+static bool checkpoint_valid(const CheckpointHeader* h) {
+    const char* base = (const char*)h;
+    int n = h->battery_count;
+    WorldConfig config = checkpoint_config(h);
+    if (!world_config_valid(&config) || h->difficulty < 1 || h->difficulty > 3) return false;
+    if (!checkpoint_in_map(h, h->heli_x, h->heli_y) || h->heli_status < H_ACTIVE ||
+        h->heli_status > H_MISSION_COMPLETE || h->heli_on_board < 0 || h->heli_on_board > HELICOPTER_CAPACITY ||
+        h->heli_rescued < 0 || h->heli_rescued > h->soldier_count ||
+        h->soldiers_at_origin < 0 || h->soldiers_at_origin > h->soldier_count) return false;
+
+    if ((h->bridge_direction != BRIDGE_TO_DEPOT && h->bridge_direction != BRIDGE_TO_COMBAT) ||
+        h->bridge_on_bridge < 0 || h->bridge_on_bridge > n) return false;
+    const int32_t* queue = (const int32_t*)(base + h->off_bridge_queue);
+    for (int d = 0; d < 2; d++) {
+        if (h->bridge_head[d] < 0 || h->bridge_head[d] >= h->bridge_capacity ||
+            h->bridge_waiting[d] < 0 || h->bridge_waiting[d] > n) return false;
+        for (int k = 0; k < h->bridge_waiting[d]; k++) {
+            int slot = (h->bridge_head[d] + k) % h->bridge_capacity;
+            if (!checkpoint_battery_id(h, queue[d * h->bridge_capacity + slot])) return false;
+        }
+    }
+    const int32_t* heap = (const int32_t*)(base + h->off_depot_heap);
+    if (h->depot_busy < 0 || h->depot_busy > h->depot_slots || h->depot_waiting < 0 || h->depot_waiting > n)
+        return false;
+    for (int k = 0; k < h->depot_waiting; k++) {
+        if (!checkpoint_battery_id(h, heap[k])) return false;
+    }
+
+    const CheckpointBattery* cb = (const CheckpointBattery*)(base + h->off_batteries);
+    for (int i = 0; i < n; i++) {
+        if (cb[i].status < B_FIRING || cb[i].status > B_FINAL_POSITIONING ||
+            !checkpoint_in_map(h, cb[i].x, cb[i].y) || !checkpoint_in_map(h, cb[i].combat_x, cb[i].combat_y) ||
+            cb[i].ammo < 0 || cb[i].ammo > cb[i].max_ammo) return false;
+    }
+    const CheckpointSoldier* cs = (const CheckpointSoldier*)(base + h->off_soldiers);
+    for (int i = 0; i < h->soldier_count; i++) {
+        if (cs[i].active && !checkpoint_in_map(h, cs[i].x, cs[i].y)) return false;
+    }
+
+    // Foguetes: só slots abaixo do limite, ativos dentro do mapa e pilha livre coerente
+    const uint64_t* mask = (const uint64_t*)(base + h->off_rocket_mask);
+    const int32_t* rx = (const int32_t*)(base + h->off_rocket_x);
+    const int32_t* ry = (const int32_t*)(base + h->off_rocket_y);
+    const int32_t* owner = (const int32_t*)(base + h->off_rocket_owner);
+    const int32_t* free_slots = (const int32_t*)(base + h->off_rocket_free);
+    int active = 0;
+    for (int i = 0; i < h->rocket_capacity; i++) {
+        if (!(mask[i >> 6] >> (i & 63) & 1)) continue;
+        if (i >= h->rocket_slots || !checkpoint_in_map(h, rx[i], ry[i]) || !checkpoint_battery_id(h, owner[i]))
+            return false;
+        active++;
+    }
+    if (h->rocket_free_top < 0 || h->rocket_free_top != h->rocket_slots - active) return false;
+    for (int k = 0; k < h->rocket_free_top; k++) {
+        int slot = free_slots[k];
+        if (slot < 0 || slot >= h->rocket_slots || (mask[slot >> 6] >> (slot & 63) & 1)) return false;
+    }
+    return true;
+}
+
+/* Mapeia e valida um checkpoint. O mapeamento fica aberto para que muitas
+   partidas (batch) restaurem do mesmo arquivo sem relê-lo. */
+bool checkpoint_open(Checkpoint* ck, const char* path) {
+    memset(ck, 0, sizeof(*ck));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return false; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); close(fd); return false; }
+    ck->bytes = (size_t)st.st_size;
+    ck->h = ck->bytes >= sizeof(CheckpointHeader) ? mmap(NULL, ck->bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (ck->h == MAP_FAILED) {
+        fprintf(stderr, "%s: checkpoint invalido\n", path);
+        ck->h = NULL;
+        return false;
+    }
+    const CheckpointHeader* h = ck->h;
+    CheckpointHeader expect = *h;
+    bool ok = memcmp(h->magic, CHECKPOINT_MAGIC, 4) == 0 && h->version == CHECKPOINT_VERSION &&
+              h->header_bytes == sizeof(CheckpointHeader) && h->battery_bytes == sizeof(CheckpointBattery) &&
+              h->battery_count >= 0 && h->battery_count <= MAX_BATTERIES && h->soldier_count >= 1 &&
+              h->rocket_slots >= 1 && h->rocket_capacity == ((h->rocket_slots + 63) & ~63) &&
+              h->bridge_capacity == (h->battery_count ? h->battery_count : 1);
+    if (ok) {
+        checkpoint_layout(&expect);
+        ok = memcmp(&expect, h, sizeof expect) == 0 && h->file_bytes == ck->bytes &&
+             checkpoint_checksum(h, h->file_bytes) == h->checksum && checkpoint_valid(h);
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: checkpoint invalido ou corrompido\n", path);
+        checkpoint_close(ck);
+        return false;
+    }
+    return true;
+}
+
+/* Monta em w (zerado, com headless já definido) o mundo do checkpoint:
+   configuração, entidades, estatísticas e timers armados. */
+void world_restore(World* w, const Checkpoint* ck) {
+    const CheckpointHeader* h = ck->h;
+    const char* base = (const char*)h;
+    w->config = checkpoint_config(h);
+    w->difficulty = h->difficulty;
+    w->seed = h->seed;
+    init_game_elements(w);
+
+    w->clock_ms = h->clock_ms;
+    w->last_board_ms = h->last_board_ms;
+    w->stats.end_ms = h->end_ms;
+    w->helicopter.x = h->heli_x;
+    w->helicopter.y = h->heli_y;
+    w->helicopter.soldiers_on_board = h->heli_on_board;
+    w->helicopter.soldiers_rescued_total = h->heli_rescued;
+    w->helicopter.status = h->heli_status;
+    w->game_state.game_over_flag = h->game_over;
+    w->game_state.victory_flag = h->victory;
+    w->game_state.soldiers_at_origin_count = h->soldiers_at_origin;
+    if (h->game_over) w->running = false;
+
+    w->bridge.direction = (BridgeDirection)h->bridge_direction;
+    w->bridge.on_bridge = h->bridge_on_bridge;
+    w->bridge.batch = h->bridge_batch;
+    w->bridge.max_queue = h->bridge_max_queue;
+    for (int d = 0; d < 2; d++) {
+        w->bridge.head[d] = h->bridge_head[d];
+        w->bridge.waiting[d] = h->bridge_waiting[d];
+        memcpy(w->bridge.queue[d], base + h->off_bridge_queue + (size_t)d * h->bridge_capacity * sizeof(int32_t),
+               h->bridge_capacity * sizeof(int32_t));
+    }
+    w->bridge.crossings = h->bridge_crossings;
+    w->bridge.waits = h->bridge_waits;
+    w->bridge.total_wait_ms = h->bridge_total_wait_ms;
+    w->bridge.max_wait_ms = h->bridge_max_wait_ms;
+
+    w->depot.busy = h->depot_busy;
+    w->depot.waiting = h->depot_waiting;
+    w->depot.max_queue = h->depot_max_queue;
+    w->depot.next_ticket = h->depot_next_ticket;
+    w->depot.admissions = h->depot_admissions;
+    w->depot.waits = h->depot_waits;
+    w->depot.total_wait_ms = h->depot_total_wait_ms;
+    w->depot.max_wait_ms = h->depot_max_wait_ms;
+    memcpy(w->depot.heap, base + h->off_depot_heap, h->battery_count * sizeof(int32_t));
+
+    const CheckpointBattery* cb = (const CheckpointBattery*)(base + h->off_batteries);
+    for (int i = 0; i < h->battery_count; i++) {
+        Battery* b = &w->batteries[i];
+        const CheckpointBattery* c = &cb[i];
+        b->x = c->x; b->y = c->y; b->combat_x = c->combat_x; b->combat_y = c->combat_y;
+        b->ammo = c->ammo; b->max_ammo = c->max_ammo; b->status = c->status;
+        b->bridge_granted = c->bridge_granted;
+        b->recharge_min_ms = c->recharge_min_ms; b->recharge_max_ms = c->recharge_max_ms;
+        b->recharge_done_ms = c->recharge_done_ms;
+        b->bridge_wait_since_ms = c->bridge_wait_since_ms; b->depot_wait_since_ms = c->depot_wait_since_ms;
+        b->depot_ticket = c->depot_ticket;
+        rng_import(&b->rng, c->rng);
+        b->rockets_fired = c->rockets_fired; b->recharges = c->recharges;
+    }
+    const CheckpointSoldier* cs = (const CheckpointSoldier*)(base + h->off_soldiers);
+    for (int i = 0; i < h->soldier_count; i++) {
+        w->soldiers[i] = (Soldier){ cs[i].x, cs[i].y, cs[i].active };
+    }
+    RocketStore* rs = &w->rockets;
+    size_t n = rs->capacity;
+    memcpy(rs->px, base + h->off_rocket_px, n * sizeof(float));
+    memcpy(rs->py, base + h->off_rocket_py, n * sizeof(float));
+    memcpy(rs->dx, base + h->off_rocket_dx, n * sizeof(float));
+    memcpy(rs->dy, base + h->off_rocket_dy, n * sizeof(float));
+    memcpy(rs->x, base + h->off_rocket_x, n * sizeof(int32_t));
+    memcpy(rs->y, base + h->off_rocket_y, n * sizeof(int32_t));
+    memcpy(rs->active_mask, base + h->off_rocket_mask, n / 64 * sizeof(uint64_t));
+    memcpy(rs->owner_battery_id, base + h->off_rocket_owner, n * sizeof(int32_t));
+    memcpy(rs->free_slots, base + h->off_rocket_free, n * sizeof(int32_t));
+    rs->free_top = h->rocket_free_top;
+
+    // Grade refeita a partir das posições restauradas
+    grid_free(&w->grid);
+    grid_init(&w->grid, w->config.map_width, w->config.map_height);
+    grid_focus(&w->grid, w->helicopter.x, w->helicopter.y);
+    for (int i = 0; i < w->config.soldier_count; i++) {
+        if (w->soldiers[i].active) grid_add(&w->grid, GRID_SOLDIERS, w->soldiers[i].x, w->soldiers[i].y);
+    }
+    for (int i = 0; i < w->config.battery_count; i++) {
+        grid_add(&w->grid, GRID_BATTERIES, w->batteries[i].x, w->batteries[i].y);
+    }
+    for (int i = rocket_store_next(rs, 0); i >= 0; i = rocket_store_next(rs, i + 1)) {
+        grid_add(&w->grid, GRID_ROCKETS, rs->x[i], rs->y[i]);
+    }
+
+    // Roda: mesmo 'now' e os mesmos prazos; a ordem de despacho é (tipo, id)
+    w->timers.now = h->tick;
+    if (h->rockets_expires != CHECKPOINT_DISARMED) world_arm_timer(w, &w->rockets_timer, h->rockets_expires);
+    if (h->helicopter_expires != CHECKPOINT_DISARMED) world_arm_timer(w, &w->helicopter_timer, h->helicopter_expires);
+    for (int i = 0; i < h->battery_count; i++) {
+        if (cb[i].step_expires != CHECKPOINT_DISARMED)
+            world_arm_timer(w, &w->batteries[i].step_timer, cb[i].step_expires);
+        if (cb[i].recharge_expires != CHECKPOINT_DISARMED)
+            world_arm_timer(w, &w->batteries[i].recharge_timer, cb[i].recharge_expires);
+    }
+}
+
+/* Estado da política no momento do checkpoint. */
+void checkpoint_restore_policy(const Checkpoint* ck, HeliPolicy* p) {
+    rng_import(&p->rng, ck->h->policy_rng);
+    p->script.next = ck->h->policy_script_next < p->script.count ? (int)ck->h->policy_script_next : p->script.count;
+}
+
+/* Bifurca: troca a semente e re-semeia baterias e política, para que
+   partidas restauradas do mesmo checkpoint sigam caminhos diferentes. */
+void world_reseed(World* w, HeliPolicy* p, uint64_t seed) {
+    w->seed = seed;
+    for (int i = 0; i < w->config.battery_count; i++) rng_seed(&w->batteries[i].rng, seed, 1 + (uint64_t)i);
+    rng_seed(&p->rng, seed, RNG_STREAM_POLICY);
+}
+
+static double elapsed_s(const struct timespec* t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+int run_headless(const Options* opt) {
+    InputScript script;
+    if (opt->replay) {
+        script = opt->replay->script; // os eventos pertencem ao ReplayData
+    } else if (!input_script_load(&script, opt->script_path)) {
+        return 1;
+    }
+
+    World* w = calloc(1, sizeof(World));
+    if (!w) { perror("calloc"); return 1; }
+    w->headless = true;
+    if (opt->checkpoint) {
+        world_restore(w, opt->checkpoint);
+    } else {
+        w->config = opt->world;
+        w->difficulty = opt->difficulty;
+        w->seed = opt->seed;
+        init_game_elements(w);
+    }
+    if (opt->publish_name && !(w->shm = shm_ring_create(w, opt->publish_name))) return 1;
+
+    ReplayLog log;
+    if (!replay_open_record(&log, opt->record_path, w)) return 1;
+    log.check = opt->verify ? opt->replay : NULL;
+    HeliPolicy policy = { .kind = opt->policy, .script = script, .world = w, .log = &log };
+    rng_seed(&policy.rng, w->seed, RNG_STREAM_POLICY);
+    if (opt->checkpoint) {
+        checkpoint_restore_policy(opt->checkpoint, &policy);
+        printf("Restaurado de %s no tick %llu\n", opt->restore_path, (unsigned long long)w->timers.now);
+    } else {
+        world_start_timers(w, true);
+    }
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long tick = (long)w->timers.now;
+    if (opt->checkpoint_path && (long)w->timers.now < opt->checkpoint_tick) {
+        tick = world_run_ticks(w, &policy, opt->checkpoint_tick);
+        /* nada vence antes de checkpoint_tick (a roda parou no primeiro tick
+           ocupado depois dele), então a roda pode avançar até lá sem disparar
+           nada: o checkpoint fica exatamente no tick pedido */
+        if (w->running) w->timers.now = (uint64_t)opt->checkpoint_tick;
+        if (!w->running) {
+            fprintf(stderr, "O jogo acabou no tick %ld, antes do checkpoint\n", tick);
+        } else if (checkpoint_save(w, &policy, opt->checkpoint_path)) {
+            printf("Checkpoint: %s (tick %llu)\n", opt->checkpoint_path, (unsigned long long)w->timers.now);
+        }
+    }
+    if (w->running) tick = world_run_ticks(w, &policy, opt->max_ticks);
+    double wall_s = elapsed_s(&t0);
+    replay_log_finish(&log, w, tick);
+
+    const char* result = w->game_state.victory_flag ? "VITORIA"
+                       : w->game_state.game_over_flag ? "DERROTA" : "TEMPO ESGOTADO";
+    printf("Resultado: %s\n", result);
+    printf("Semente: %llu\n", (unsigned long long)w->seed);
+    printf("Soldados resgatados: %d\n", w->helicopter.soldiers_rescued_total);
+    printf("Ticks simulados: %ld (%.1f s logicos)\n", tick, tick * w->config.tick_ms / 1000.0);
+    printf("Tempo real: %.3f s | %.0f ticks/s\n", wall_s, wall_s > 0 ? tick / wall_s : 0.0);
+    printf("Ponte: %ld travessias | %ld esperas, media %.0f ms, maxima %ld ms | fila maxima %d\n",
+           w->bridge.crossings, w->bridge.waits,
+           w->bridge.waits ? (double)w->bridge.total_wait_ms / w->bridge.waits : 0.0,
+           w->bridge.max_wait_ms, w->bridge.max_queue);
+    printf("Deposito: %ld recargas | %ld esperas, media %.0f ms, maxima %ld ms | fila maxima %d\n",
+           w->depot.admissions, w->depot.waits,
+           w->depot.waits ? (double)w->depot.total_wait_ms / w->depot.waits : 0.0,
+           w->depot.max_wait_ms, w->depot.max_queue);
+    int rc = replay_report(&log);
+
+    shm_ring_close(w->shm);
+    cleanup_game_resources(w);
+    free(w);
+    if (!opt->replay) free(script.events);
+    return rc;
+}
+
+// --- Modo batch (Monte Carlo) ---
+typedef struct {
+    unsigned seed;
+    int difficulty;
+    bool victory;
+    bool lost;
+    int rescued;
+    long ticks;
+    long time_to_loss_ms; // -1 se não perdeu
+    int rockets_fired;
+    int recharges;
+    long bridge_max_wait_ms;
+    int bridge_max_queue;
+} GameResult;
+
+typedef struct {
+    const Options* opt;
+    const InputScript* script;
+    GameResult* results;
+    atomic_int next_game;
+} BatchJob;
+
+static void batch_run_one(const BatchJob* job, int idx) {
+    const Options* opt = job->opt;
+    GameResult* res = &job->results[idx];
+    World* w = calloc(1, sizeof(World));
+    if (!w) { perror("calloc"); exit(1); }
+
+    res->seed = opt->seed + (unsigned)idx;
+    res->difficulty = opt->difficulty > 0 ? opt->difficulty : idx % 3 + 1;
+    w->headless = true;
+    HeliPolicy policy = { .kind = opt->policy, .script = *job->script };
+    if (opt->checkpoint) {
+        /* todas partem do mesmo meio de jogo; a semente da partida decide o resto */
+        world_restore(w, opt->checkpoint);
+        checkpoint_restore_policy(opt->checkpoint, &policy);
+        world_reseed(w, &policy, res->seed);
+        res->difficulty = w->difficulty;
+        res->ticks = world_run_ticks(w, &policy, opt->max_ticks);
+    } else {
+        w->config = opt->world;
+        w->difficulty = res->difficulty;
+        w->seed = res->seed;
+        init_game_elements(w);
+        rng_seed(&policy.rng, w->seed, RNG_STREAM_POLICY);
+        res->ticks = world_run_headless(w, &policy, opt->max_ticks);
+    }
+    res->victory = w->game_state.victory_flag;
+    res->lost = w->game_state.game_over_flag && !w->game_state.victory_flag;
+    res->rescued = w->helicopter.soldiers_rescued_total;
+    res->time_to_loss_ms = res->lost ? w->stats.end_ms : -1;
+    res->rockets_fired = 0;
+    res->recharges = 0;
+    for (int i = 0; i < w->config.battery_count; i++) {
+        res->rockets_fired += w->batteries[i].rockets_fired;
+        res->recharges += w->batteries[i].recharges;
+    }
+    res->bridge_max_wait_ms = w->bridge.max_wait_ms;
+    res->bridge_max_queue = w->bridge.max_queue;
+
+    cleanup_game_resources(w);
+    free(w);
+}
+
+static void* batch_worker_func(void* arg) {
+    BatchJob* job = arg;
+    int idx;
+    trace_thread_name("batch");
+    while ((idx = atomic_fetch_add(&job->next_game, 1)) < job->opt->batch_games) {
+        batch_run_one(job, idx);
+    }
+    return NULL;
+}
+
+static const char* policy_name(PolicyKind k) {
+    switch (k) {
+        case POLICY_SCRIPT:    return "script";
+        case POLICY_RANDOM:    return "random";
+        case POLICY_AUTOPILOT: return "autopilot";
+        default:               return "none";
+    }
+}
+
+static const char* result_name(const GameResult* r) {
+    return r->victory ? "victory" : r->lost ? "loss" : "timeout";
+}
+
+static bool write_batch_report(const char* path, const Options* opt, const GameResult* res,
+                               int wins, double mean_rescued, double mean_loss_ms, double mean_ammo,
+                               double wall_s) {
+    FILE* f = fopen(path, "w");
+    if (!f) { perror(path); return false; }
+    size_t len = strlen(path);
+    bool json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+    int n = opt->batch_games;
+
+    if (json) {
+        fprintf(f, "{\n  \"summary\": {\"games\": %d, \"policy\": \"%s\", \"win_rate\": %.4f, "
+                   "\"mean_rescued\": %.3f, \"mean_time_to_loss_ms\": %.1f, "
+                   "\"mean_rockets_fired\": %.3f, \"wall_s\": %.3f},\n  \"games\": [\n",
+                n, policy_name(opt->policy), (double)wins / n, mean_rescued, mean_loss_ms, mean_ammo, wall_s);
+        for (int i = 0; i < n; i++) {
+            fprintf(f, "    {\"seed\": %u, \"difficulty\": %d, \"result\": \"%s\", \"rescued\": %d, "
+                       "\"ticks\": %ld, \"time_to_loss_ms\": %ld, \"rockets_fired\": %d, \"recharges\": %d, "
+                       "\"bridge_max_wait_ms\": %ld, \"bridge_max_queue\": %d}%s\n",
+                    res[i].seed, res[i].difficulty, result_name(&res[i]), res[i].rescued,
+                    res[i].ticks, res[i].time_to_loss_ms, res[i].rockets_fired, res[i].recharges,
+                    res[i].bridge_max_wait_ms, res[i].bridge_max_queue,
+                    i + 1 < n ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+    } else {
+        fprintf(f, "seed,difficulty,policy,result,rescued,ticks,time_to_loss_ms,rockets_fired,recharges,"
+                   "bridge_max_wait_ms,bridge_max_queue\n");
+        for (int i = 0; i < n; i++) {
+            fprintf(f, "%u,%d,%s,%s,%d,%ld,%ld,%d,%d,%ld,%d\n",
+                    res[i].seed, res[i].difficulty, policy_name(opt->policy), result_name(&res[i]),
+                    res[i].rescued, res[i].ticks, res[i].time_to_loss_ms,
+                    res[i].rockets_fired, res[i].recharges,
+                    res[i].bridge_max_wait_ms, res[i].bridge_max_queue);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+/* Roda opt->batch_games partidas independentes em opt->jobs threads. Cada
+   partida tem seu próprio World, então as threads não compartilham locks. */
+int run_batch(const Options* opt) {
+    InputScript script;
+    if (!input_script_load(&script, opt->script_path)) return 1;
+
+    int n = opt->batch_games;
+    GameResult* results = calloc(n, sizeof(GameResult));
+    pthread_t* tids = calloc(opt->jobs, sizeof(pthread_t));
+    if (!results || !tids) { perror("calloc"); return 1; }
+
+    BatchJob job;
+    job.opt = opt;
+    job.script = &script;
+    job.results = results;
+    atomic_init(&job.next_game, 0);
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < opt->jobs; i++) {
+        if (pthread_create(&tids[i], NULL, batch_worker_func, &job) != 0) {
+            perror("Failed to create batch worker"); return 1;
+        }
+    }
+    for (int i = 0; i < opt->jobs; i++) pthread_join(tids[i], NULL);
+    double wall_s = elapsed_s(&t0);
+
+    int wins = 0, losses = 0;
+    long total_rescued = 0, total_ammo = 0, total_ticks = 0;
+    double total_loss_ms = 0;
+    for (int i = 0; i < n; i++) {
+        wins += results[i].victory;
+        total_rescued += results[i].rescued;
+        total_ammo += results[i].rockets_fired;
+        total_ticks += results[i].ticks;
+        if (results[i].lost) { losses++; total_loss_ms += results[i].time_to_loss_ms; }
+    }
+    double mean_rescued = (double)total_rescued / n;
+    double mean_loss_ms = losses ? total_loss_ms / losses : 0.0;
+    double mean_ammo = (double)total_ammo / n;
+
+    printf("Partidas: %d (%d threads, politica %s)\n", n, opt->jobs, policy_name(opt->policy));
+    printf("Vitorias: %d (%.1f%%) | Derrotas: %d\n", wins, 100.0 * wins / n, losses);
+    printf("Media de resgatados: %.2f | Tempo medio ate a derrota: %.1f s\n", mean_rescued, mean_loss_ms / 1000.0);
+    printf("Media de foguetes disparados: %.2f\n", mean_ammo);
+    printf("Tempo real: %.3f s | %.0f partidas/s | %.0f ticks/s\n",
+           wall_s, wall_s > 0 ? n / wall_s : 0.0, wall_s > 0 ? total_ticks / wall_s : 0.0);
+
+    bool ok = true;
+    if (opt->report_path) {
+        ok = write_batch_report(opt->report_path, opt, results, wins, mean_rescued, mean_loss_ms, mean_ammo, wall_s);
+    }
+    free(results);
+    free(tids);
+    free(script.events);
+    return ok ? 0 : 1;
+}
+
+typedef struct {
+    long ticks;       // ticks simulados
+    long fired;       // timers disparados
+    long crossings;   // travessias da ponte
+    long admissions;  // entradas no depósito
+} SchedBenchResult;
+
+/* Uma rodada do benchmark: mundo com relógio lógico, escalonador na thread
+   atual com 'workers' ajudantes, sem esperar o relógio de parede até
+   opt->max_ticks. O helicóptero fica parado (sem timer), então a partida
+   não termina antes do limite e as baterias ciclam entre tiro e recarga. */
+static double sched_bench_run(const Options* opt, const WorldConfig* config, int workers, bool actor,
+                              SchedBenchResult* res) {
+    World* w = calloc(1, sizeof(World));
+    if (!w) { perror("calloc"); return -1; }
+    w->config = *config;
+    w->difficulty = opt->difficulty ? opt->difficulty : 2;
+    w->seed = opt->seed;
+    w->deterministic = true;
+    w->actor = actor;
+    init_game_elements(w);
+
+    Scheduler s;
+    if (!scheduler_start(&s, w, workers, NULL)) return -1;
+    s.unpaced = true;
+    s.tick_limit = (uint64_t)opt->max_ticks;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    scheduler_thread_func(&s);
+    double wall_s = elapsed_s(&t0);
+    scheduler_stop(&s);
+
+    res->ticks = (long)s.tick_limit;
+    res->fired = s.timers_fired;
+    res->crossings = w->bridge.crossings;
+    res->admissions = w->depot.admissions;
+    cleanup_game_resources(w);
+    free(w);
+    return wall_s;
+}
+
+/* --bench-actor: o mesmo fluxo de timers despachado por workers com locks
+   (desenho compartilhado) e por uma só thread dona sem locks (modo ator). */
+int run_actor_bench(const Options* opt) {
+    SchedBenchResult shared, actor;
+    double shared_s = sched_bench_run(opt, &opt->world, opt->jobs - 1, false, &shared);
+    double actor_s = sched_bench_run(opt, &opt->world, 0, true, &actor);
+    if (shared_s < 0 || actor_s < 0) return 1;
+
+    printf("Baterias: %d | ticks: %ld | workers no modo compartilhado: %d\n",
+           opt->world.battery_count, opt->max_ticks, opt->jobs - 1);
+    printf("Compartilhado: %.3f s | %ld timers | %.0f timers/s\n",
+           shared_s, shared.fired, shared_s > 0 ? shared.fired / shared_s : 0.0);
+    printf("Ator:          %.3f s | %ld timers | %.0f timers/s | %.2fx\n",
+           actor_s, actor.fired, actor_s > 0 ? actor.fired / actor_s : 0.0,
+           actor_s > 0 ? shared_s / actor_s : 0.0);
+    return 0;
+}
+
+int run_render_bench(const Options* opt); // junto do renderizador
+int run_spectate(const Options* opt);     // idem
+int run_bench_suite(const Options* opt);  // idem
+
+// --- Main ---
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_options(argc, argv, &opt)) return 2;
+    if (opt.trace_path && !trace_start(opt.trace_path)) return 1;
+    trace_thread_name("main");
+    if (opt.spectate_name) return run_spectate(&opt);
+    if (opt.bench_render) {
+        int rc = run_render_bench(&opt);
+        trace_stop();
+        return rc;
+    }
+    if (opt.bench) {
+        int rc = run_bench_suite(&opt);
+        trace_stop();
+        return rc;
+    }
+    if (opt.bench_actor) {
+        int rc = run_actor_bench(&opt);
+        trace_stop();
+        lock_stats_dump(stderr);
+        return rc;
+    }
+    static Checkpoint checkpoint; // mapeado uma vez, lido por todas as partidas
+    if (opt.restore_path) {
+        if (!checkpoint_open(&checkpoint, opt.restore_path)) return 1;
+        opt.checkpoint = &checkpoint;
+    }
+    if (opt.batch_games > 0) {
+        int rc = run_batch(&opt);
+        checkpoint_close(&checkpoint);
+        trace_stop();
+        lock_stats_dump(stderr);
+        return rc;
+    }
+    ReplayData replay_data;
+    if (opt.replay_path && !replay_load(&replay_data, &opt)) return 1;
+    if (opt.headless) {
+        int rc = run_headless(&opt);
+        checkpoint_close(&checkpoint);
+        trace_stop();
+        lock_stats_dump(stderr);
+        if (opt.replay) replay_data_free(&replay_data);
+        return rc;
+    }
+
+    static World game;
+    World* w = &game;
+    w->config = opt.world;
+    w->seed = opt.seed; // Para aleatoriedade (reproduzível com --seed)
+    w->deterministic = opt.record_path || opt.replay;
+    w->actor = opt.actor;
+
+    // Inicialização do Ncurses
+    initscr();
+    cbreak();
+    noecho();
+    curs_set(0); // Esconde o cursor
+    keypad(stdscr, TRUE); // Permite uso de setas
+    nodelay(stdscr, TRUE); // getch() não bloqueante
+
+    if (opt.difficulty > 0) {
+        w->difficulty = opt.difficulty;
+    } else {
+        mvprintw(SCREEN_HEIGHT / 2 - 2, SCREEN_WIDTH / 2 - 15, "Escolha a dificuldade:");
+        mvprintw(SCREEN_HEIGHT / 2 - 0, SCREEN_WIDTH / 2 - 15, "1: Facil");
+        mvprintw(SCREEN_HEIGHT / 2 + 1, SCREEN_WIDTH / 2 - 15, "2: Medio");
+        mvprintw(SCREEN_HEIGHT / 2 + 2, SCREEN_WIDTH / 2 - 15, "3: Dificil");
+        refresh();
+
+        int choice = 0;
+        nodelay(stdscr, FALSE); // Bloqueante para escolha
+        while(choice < '1' || choice > '3') {
+            choice = getch();
+        }
+        w->difficulty = choice - '0';
+        nodelay(stdscr, TRUE); // Volta para não bloqueante
+    }
+    clear();
+    refresh();
+
+
+    init_game_elements(w);
+    RenderThreadArg render_arg = { w, snapshot_channel_create(w), opt.render, STDOUT_FILENO };
+    int rc = 1;
+    bool played = false; // falso se o jogo nem começou: só desmonta e sai
+    if (opt.publish_name && !(w->shm = shm_ring_create(w, opt.publish_name))) goto teardown;
+    world_publish_snapshot(w);
+
+    pthread_t tid_helicopter, tid_scheduler, tid_game_manager;
+    /* Baterias e foguetes rodam no escalonador; com muitas baterias ele usa
+       um worker por núcleo restante (ticks pequenos continuam seriais). */
+    int sched_workers = w->config.battery_count >= SCHED_PARALLEL_MIN ? opt.jobs - 1 : 0;
+
+    /* Gravação/replay e modo ator: o helicóptero vira timer do escalonador e
+       tudo roda em ordem numa thread, como no headless (o que também deixa o
+       log reproduzível). */
+    ReplayLog log;
+    if (!replay_open_record(&log, opt.record_path, w)) goto teardown;
+    log.check = opt.verify ? opt.replay : NULL;
+    HeliPolicy policy = { .kind = opt.replay ? POLICY_SCRIPT : POLICY_KEYBOARD, .world = w, .log = &log };
+    if (opt.replay) policy.script = opt.replay->script;
+    rng_seed(&policy.rng, w->seed, RNG_STREAM_POLICY);
+    bool single_thread = w->deterministic || w->actor;
+    if (single_thread) sched_workers = 0;
+
+    Scheduler scheduler;
+    if (!scheduler_start(&scheduler, w, sched_workers, single_thread ? &policy : NULL)) {
+        if (log.out) fclose(log.out);
+        goto teardown;
+    }
+
+    // Criação das threads (no replay o teclado é ignorado)
+    void* (*input_func)(void*) = !single_thread ? helicopter_thread_func
+                               : !opt.replay ? keyboard_thread_func : NULL;
+    bool input_started = false, scheduler_started = false;
+    if (input_func && !(input_started = pthread_create(&tid_helicopter, NULL, input_func, w) == 0)) {
+        perror("Failed to create helicopter thread");
+    } else if (!(scheduler_started = pthread_create(&tid_scheduler, NULL, scheduler_thread_func, &scheduler) == 0)) {
+        perror("Failed to create scheduler thread");
+    } else if (!(played = pthread_create(&tid_game_manager, NULL, game_manager_thread_func, &render_arg) == 0)) {
+        perror("Failed to create game manager thread");
+    }
+    if (!played) { // derruba as threads que chegaram a subir
+        GAME_LOCK(&w->game_state.mutex);
+        world_shutdown(w);
+        GAME_UNLOCK(&w->game_state.mutex);
+    }
+
+    // Aguarda finalização das threads persistentes
+    if (input_started) pthread_join(tid_helicopter, NULL);
+    if (scheduler_started) pthread_join(tid_scheduler, NULL);
+    scheduler_stop(&scheduler);
+    if (!played) {
+        if (log.out) fclose(log.out);
+        goto teardown;
+    }
+    pthread_join(tid_game_manager, NULL);
+    if (w->deterministic) replay_log_finish(&log, w, (long)w->timers.now);
+
+
+    clear();
+    mvprintw(SCREEN_HEIGHT / 2 - 1, SCREEN_WIDTH / 2 - 10, "FIM DE JOGO!");
+    GAME_LOCK(&w->game_state.mutex);
+    if (w->game_state.victory_flag) {
+        mvprintw(SCREEN_HEIGHT / 2 + 1, SCREEN_WIDTH / 2 - 10, "VOCE VENCEU!");
+    } else {
+        mvprintw(SCREEN_HEIGHT / 2 + 1, SCREEN_WIDTH / 2 - 10, "VOCE PERDEU!");
+    }
+    GAME_UNLOCK(&w->game_state.mutex);
+    refresh();
+    nodelay(stdscr, FALSE); // Bloqueante para ver a msg final
+    getch();
+
+teardown: // também a saída das falhas depois do initscr
+    endwin();
+    if (played) {
+        printf("Jogo encerrado.\n");
+        GAME_LOCK(&w->game_state.mutex);
+        if(w->game_state.victory_flag) printf("Resultado: VITORIA!\n"); else printf("Resultado: DERROTA!\n");
+        GAME_UNLOCK(&w->game_state.mutex);
+        printf("Soldados resgatados: %d\n", w->helicopter.soldiers_rescued_total);
+        printf("Semente: %llu (repita com --seed)\n", (unsigned long long)w->seed);
+        rc = replay_report(&log);
+    }
+    trace_stop();
+    lock_stats_dump(stderr);
+
+    // Limpeza
+    shm_ring_close(w->shm);
+    cleanup_game_resources(w);
+    if (opt.replay) replay_data_free(&replay_data);
+
+    return rc;
+}
+
+// --- Implementação das Threads ---
+
+/* Encerra o jogo com o helicóptero destruído. Chamar com helicopter.mutex travado. */
+static void helicopter_explode_locked(World* w) {
+    w->helicopter.status = H_EXPLODED;
+    GAME_LOCK(&w->game_state.mutex);
+    w->game_state.game_over_flag = true;
+    w->stats.end_ms = sim_now_ms(w);
+    world_shutdown(w);
+    GAME_UNLOCK(&w->game_state.mutex);
+}
+
+/* Um passo do helicóptero: aplica o comando, checa colisões e embarca ou
+   desembarca soldados. Retorna false quando o jogo acabou. */
+bool helicopter_step(World* w, HeliCommand cmd) {
+    GAME_LOCK(&w->helicopter.mutex);
+    if (w->helicopter.status == H_EXPLODED) { // Se explodiu por outra causa (foguete, etc)
+        GAME_UNLOCK(&w->helicopter.mutex);
+        return false;
+    }
+    int from_x = w->helicopter.x, from_y = w->helicopter.y;
+
+    // Movimentação
+    switch (cmd) {
+        case CMD_UP:    w->helicopter.y--; break;
+        case CMD_DOWN:  w->helicopter.y++; break;
+        case CMD_LEFT:  w->helicopter.x--; break;
+        case CMD_RIGHT: w->helicopter.x++; break;
+        default: /* nada */;
+    }
+
+    // Limites do mapa
+    if (w->helicopter.x < 0)                          w->helicopter.x = 0;
+    if (w->helicopter.x >  w->config.map_width - 1)   w->helicopter.x = w->config.map_width - 1;
+    if (w->helicopter.y < 0)                          w->helicopter.y = 0;
+    if (w->helicopter.y >  w->config.map_height - 1)  w->helicopter.y = w->config.map_height - 1;
+
+    /* Colisões com obstáculos fixos (bordas, depósito, ponte) e baterias:
+       uma consulta à grade, sem travar nenhuma bateria. Plataforma e
+       origem não são obstáculos. */
+    int hx = w->helicopter.x, hy = w->helicopter.y;
+    grid_focus(&w->grid, hx, hy);
+    if (grid_is_static(&w->grid, hx, hy) || grid_count(&w->grid, GRID_BATTERIES, hx, hy) > 0) {
+        helicopter_explode_locked(w);
+        GAME_UNLOCK(&w->helicopter.mutex);
+        return false;
+    }
+
+    // Lógica de Soldados
+    GAME_LOCK(&w->game_state.mutex);
+    long now_ms = sim_now_ms(w);
+
+    if (grid_count(&w->grid, GRID_SOLDIERS, hx, hy) > 0 &&
+        w->helicopter.soldiers_on_board < HELICOPTER_CAPACITY &&
+        now_ms - w->last_board_ms >= BOARDING_INTERVAL_MS) {
+        /* só procura qual soldado embarca quando a grade diz que há algum aqui */
+        for (int i = 0; i < w->config.soldier_count; ++i) {
+            if (w->soldiers[i].active && w->soldiers[i].x == hx && w->soldiers[i].y == hy) {
+                w->soldiers[i].active = false;
+                grid_remove(&w->grid, GRID_SOLDIERS, hx, hy);
+                w->helicopter.soldiers_on_board++;
+                w->game_state.soldiers_at_origin_count--;
+                w->last_board_ms = now_ms;          /* reinicia cronômetro */
+                break;
+            }
+        }
+    }
+    if (w->helicopter.x == PLATFORM_X && w->helicopter.y == PLATFORM_Y && w->helicopter.soldiers_on_board > 0) {
+        w->helicopter.soldiers_rescued_total += w->helicopter.soldiers_on_board;
+        w->helicopter.soldiers_on_board = 0;
+        if (w->helicopter.soldiers_rescued_total >= w->config.soldier_count) {
+            w->helicopter.status = H_MISSION_COMPLETE;
+            w->game_state.game_over_flag = true;
+            w->game_state.victory_flag = true;
+            w->stats.end_ms = now_ms;
+            world_shutdown(w);
+        }
+    }
+    GAME_UNLOCK(&w->game_state.mutex);
+
+
+    /* Colisão com foguetes parados no caminho deste movimento (o caso de
+       foguetes que atravessam o helicóptero é do passo de física). A lista
+       só é percorrida se a grade tiver algum foguete no segmento. */
+    int rx, ry;
+    if (grid_sweep(&w->grid, GRID_ROCKETS, from_x, from_y, hx, hy, &rx, &ry)) {
+        GAME_LOCK(&w->mutex_rocket_list);
+        for (int i = rocket_store_next(&w->rockets, 0); i >= 0; i = rocket_store_next(&w->rockets, i + 1)) {
+            if (w->rockets.x[i] == rx && w->rockets.y[i] == ry) {
+                rocket_release(&w->rockets, &w->grid, i); // Foguete some
+                helicopter_explode_locked(w);
+                break;
+            }
+        }
+        GAME_UNLOCK(&w->mutex_rocket_list);
+    }
+
+    bool keep_going = true;
+    GAME_LOCK(&w->game_state.mutex);
+    if(w->game_state.game_over_flag) keep_going = false;
+    GAME_UNLOCK(&w->game_state.mutex);
+
+    GAME_UNLOCK(&w->helicopter.mutex);
+    return keep_going;
+}
+
+/* Célula do helicóptero para o teste contínuo dos foguetes; false se ele
+   não for mais alvo (explodiu ou terminou a missão). */
+static bool helicopter_sweep_target(World* w, SweepTarget* t) {
+    GAME_LOCK(&w->helicopter.mutex);
+    bool armed = w->helicopter.status == H_ACTIVE;
+    t->x = w->helicopter.x;
+    t->y = w->helicopter.y;
+    GAME_UNLOCK(&w->helicopter.mutex);
+    return armed;
+}
+
+/* Um foguete atravessou a célula do helicóptero no passo de física. Chamar
+   sem mutex_rocket_list (a ordem é helicóptero -> foguetes). */
+static void helicopter_rocket_hit(World* w) {
+    GAME_LOCK(&w->helicopter.mutex);
+    if (w->helicopter.status == H_ACTIVE) helicopter_explode_locked(w);
+    GAME_UNLOCK(&w->helicopter.mutex);
+}
+
+static HeliCommand command_from_key(int key) {
+    switch (key) {
+        case KEY_UP:    return CMD_UP;
+        case KEY_DOWN:  return CMD_DOWN;
+        case KEY_LEFT:  return CMD_LEFT;
+        case KEY_RIGHT: return CMD_RIGHT;
+        default:        return CMD_NONE;
+    }
+}
+
+/* Dorme em poll() no stdin até chegar uma tecla ou vencer o próximo passo.
+   Cada tecla vira um movimento, aplicado na hora se o último movimento foi
+   há pelo menos HELICOPTER_STEP_MS; senão fica na fila (as mais antigas são
+   descartadas quando ela enche, para não acumular atraso com autorepeat).
+   Sem teclas, o passo periódico continua checando embarque e colisões. */
+void* helicopter_thread_func(void* arg) {
+    World* w = arg;
+    HeliCommand queue[HELICOPTER_INPUT_QUEUE];
+    int queued = 0;
+    long now = sim_now_ms(w);
+    long last_move_ms = now - HELICOPTER_STEP_MS;
+    long next_idle_ms = now + HELICOPTER_STEP_MS;
+    struct pollfd pfd[2] = { { .fd = STDIN_FILENO, .events = POLLIN }, { .fd = w->shutdown_fd, .events = POLLIN } };
+    trace_thread_name("helicoptero");
+
+    while (w->running) {
+        now = sim_now_ms(w);
+        long wake_ms = next_idle_ms;
+        if (queued > 0 && last_move_ms + HELICOPTER_STEP_MS < wake_ms) wake_ms = last_move_ms + HELICOPTER_STEP_MS;
+        int timeout = wake_ms > now ? (int)(wake_ms - now) : 0;
+
+        if (poll(pfd, 2, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (pfd[1].revents & POLLIN) break; // fim de jogo
+        if (pfd[0].revents & POLLIN) {
+            int key;
+            while ((key = getch()) != ERR) { // getch() não bloqueante: esvazia o que chegou
+                HeliCommand cmd = command_from_key(key);
+                if (cmd == CMD_NONE) continue;
+                if (queued == HELICOPTER_INPUT_QUEUE) {
+                    memmove(queue, queue + 1, (HELICOPTER_INPUT_QUEUE - 1) * sizeof queue[0]);
+                    queued--;
+                }
+                queue[queued++] = cmd;
+            }
+        }
+
+        now = sim_now_ms(w);
+        HeliCommand cmd = CMD_NONE;
+        if (queued > 0 && now - last_move_ms >= HELICOPTER_STEP_MS) {
+            cmd = queue[0];
+            memmove(queue, queue + 1, --queued * sizeof queue[0]);
+            last_move_ms = now;
+        } else if (now < next_idle_ms) {
+            continue;
+        }
+        next_idle_ms = now + HELICOPTER_STEP_MS;
+
+        uint64_t start = trace_begin();
+        bool keep_going = helicopter_step(w, cmd);
+        /* o quadro sai do escalonador, com baterias e foguetes parados */
+        atomic_fetch_or(&w->heli_pending, cmd != CMD_NONE ? HELI_STEPPED | HELI_MOVED : HELI_STEPPED);
+        trace_span("passo", "helicoptero", start, "cmd", cmd);
+        if (!keep_going) break;
+    }
+    return NULL;
+}
+
+// --- Árbitro da ponte ---
+static bool bridge_can_enter_locked(const BridgeArbiter* br, BridgeDirection dir) {
+    if (br->on_bridge > 0 && br->direction != dir) return false;
+    return !(br->waiting[!dir] > 0 && br->direction == dir && br->batch >= BRIDGE_MAX_BATCH);
+}
+
+static void bridge_enter_locked(BridgeArbiter* br, BridgeDirection dir) {
+    if (br->direction != dir) {
+        br->direction = dir;
+        br->batch = 0;
+    }
+    br->on_bridge++;
+    br->batch++;
+    br->crossings++;
+}
+
+/* Com o mutex travado: vira o sentido se a ponte esvaziou e o outro lado
+   espera (e o lote atual acabou ou não tem mais ninguém), depois libera os
+   próximos da fila do sentido corrente e rearma o passo deles. */
+static void bridge_admit_locked(World* w) {
+    BridgeArbiter* br = &w->bridge;
+    BridgeDirection other = !br->direction;
+    if (br->on_bridge == 0 && br->waiting[other] > 0 &&
+        (br->waiting[br->direction] == 0 || br->batch >= BRIDGE_MAX_BATCH)) {
+        br->direction = other;
+        br->batch = 0;
+    }
+    BridgeDirection dir = br->direction;
+    long now = sim_now_ms(w);
+    while (br->waiting[dir] > 0 && bridge_can_enter_locked(br, dir)) {
+        Battery* b = &w->batteries[br->queue[dir][br->head[dir]]];
+        br->head[dir] = (br->head[dir] + 1) % br->capacity;
+        br->waiting[dir]--;
+        bridge_enter_locked(br, dir);
+
+        trace_async('e', "ponte", "fila ponte", b->id);
+        trace_async('b', "ponte", "ponte", b->id);
+        long waited = now - b->bridge_wait_since_ms;
+        br->waits++;
+        br->total_wait_ms += waited;
+        if (waited > br->max_wait_ms) br->max_wait_ms = waited;
+        b->bridge_granted = true; // lido pelo próprio battery_step, sob br->mutex
+        world_arm_timer(w, &b->step_timer, w->timers.now);
+    }
+}
+
+/* Pede a ponte no sentido dir. Retorna true se a bateria pode entrar agora;
+   senão ela entra na fila e deve desarmar o passo até ser liberada. */
+static bool bridge_request(World* w, Battery* b, BridgeDirection dir) {
+    BridgeArbiter* br = &w->bridge;
+    bool got = false;
+    GAME_LOCK(&br->mutex);
+    if (b->bridge_granted) {
+        b->bridge_granted = false;
+        got = true;
+    } else if (br->waiting[dir] == 0 && bridge_can_enter_locked(br, dir)) {
+        bridge_enter_locked(br, dir);
+        trace_async('b', "ponte", "ponte", b->id);
+        got = true;
+    } else {
+        trace_async('b', "ponte", "fila ponte", b->id);
+        br->queue[dir][(br->head[dir] + br->waiting[dir]) % br->capacity] = b->id;
+        br->waiting[dir]++;
+        b->bridge_wait_since_ms = sim_now_ms(w);
+        int queued = br->waiting[0] + br->waiting[1];
+        if (queued > br->max_queue) br->max_queue = queued;
+    }
+    GAME_UNLOCK(&br->mutex);
+    return got;
+}
+
+static void bridge_leave(World* w, Battery* b) {
+    trace_async('e', "ponte", "ponte", b->id);
+    GAME_LOCK(&w->bridge.mutex);
+    w->bridge.on_bridge--;
+    bridge_admit_locked(w);
+    GAME_UNLOCK(&w->bridge.mutex);
+}
+
+// --- Depósito ---
+static bool depot_before(const World* w, int a, int b) {
+    const Battery* ba = &w->batteries[a];
+    const Battery* bb = &w->batteries[b];
+    if (w->depot.policy == DEPOT_LOWEST_AMMO && ba->ammo != bb->ammo) return ba->ammo < bb->ammo;
+    return ba->depot_ticket < bb->depot_ticket;
+}
+
+static void depot_push_locked(World* w, int id) {
+    Depot* d = &w->depot;
+    int i = d->waiting++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!depot_before(w, id, d->heap[parent])) break;
+        d->heap[i] = d->heap[parent];
+        i = parent;
+    }
+    d->heap[i] = id;
+}
+
+static int depot_pop_locked(World* w) {
+    Depot* d = &w->depot;
+    int top = d->heap[0];
+    int last = d->heap[--d->waiting];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= d->waiting) break;
+        if (child + 1 < d->waiting && depot_before(w, d->heap[child + 1], d->heap[child])) child++;
+        if (!depot_before(w, d->heap[child], last)) break;
+        d->heap[i] = d->heap[child];
+        i = child;
+    }
+    d->heap[i] = last;
+    return top;
+}
+
+/* Ocupa uma vaga e arma o fim da recarga. Chamar com depot.mutex travado;
+   a bateria está parada (passo desarmado), então só o depósito a toca. */
+static void depot_start_recharge_locked(World* w, Battery* b) {
+    trace_async('b', "deposito", "deposito", b->id);
+    w->depot.busy++;
+    w->depot.admissions++;
+    long recharge_duration_ms = b->recharge_min_ms + rng_below(&b->rng, (uint32_t)(b->recharge_max_ms - b->recharge_min_ms + 1));
+    b->recharge_done_ms = sim_now_ms(w) + recharge_duration_ms;
+    world_arm_timer(w, &b->recharge_timer, world_tick_at_ms(w, b->recharge_done_ms));
+}
+
+void depot_request(World* w, Battery* b) {
+    Depot* d = &w->depot;
+    GAME_LOCK(&d->mutex);
+    b->depot_ticket = d->next_ticket++;
+    if (d->busy < d->slots && d->waiting == 0) {
+        depot_start_recharge_locked(w, b);
+    } else {
+        b->depot_wait_since_ms = sim_now_ms(w);
+        trace_async('b', "deposito", "fila deposito", b->id);
+        depot_push_locked(w, b->id);
+        if (d->waiting > d->max_queue) d->max_queue = d->waiting;
+    }
+    GAME_UNLOCK(&d->mutex);
+}
+
+/* Libera uma vaga e admite o próximo do heap, se houver. */
+void depot_release(World* w) {
+    Depot* d = &w->depot;
+    GAME_LOCK(&d->mutex);
+    d->busy--;
+    if (d->waiting > 0 && d->busy < d->slots) {
+        Battery* b = &w->batteries[depot_pop_locked(w)];
+        trace_async('e', "deposito", "fila deposito", b->id);
+        long waited = sim_now_ms(w) - b->depot_wait_since_ms;
+        d->waits++;
+        d->total_wait_ms += waited;
+        if (waited > d->max_wait_ms) d->max_wait_ms = waited;
+        depot_start_recharge_locked(w, b);
+    }
+    GAME_UNLOCK(&d->mutex);
+}
+
+/* Guarda uma tecla para o timer do helicóptero, descartando a mais antiga
+   se a fila estiver cheia. Chamar com input_mutex (ou na thread dona). */
+static void world_queue_input(World* w, HeliCommand cmd) {
+    if (w->input_count == HELICOPTER_INPUT_QUEUE) {
+        memmove(w->input_queue, w->input_queue + 1, (HELICOPTER_INPUT_QUEUE - 1) * sizeof(HeliCommand));
+        w->input_count--;
+    }
+    w->input_queue[w->input_count++] = cmd;
+}
+
+/* Modo ator: aplica os comandos pendentes na caixa. Só a thread dona. */
+static void world_apply_commands(World* w) {
+    SimCommand* c;
+    while ((c = command_queue_pop(&w->commands))) {
+        switch (c->kind) {
+            case SIM_HELI_INPUT: world_queue_input(w, (HeliCommand)c->arg); break;
+        }
+        free(c);
+    }
+}
+
+/* Modo determinístico (--record) e modo ator: só lê o teclado. Os comandos
+   esperam na fila do mundo e são consumidos pelo timer do helicóptero, para
+   que o tick de cada um seja o mesmo no replay. No modo ator a tecla passa
+   pela caixa de comandos e quem a põe na fila é a thread dona. */
+void* keyboard_thread_func(void* arg) {
+    World* w = arg;
+    trace_thread_name("teclado");
+    struct pollfd pfd[2] = { { .fd = STDIN_FILENO, .events = POLLIN }, { .fd = w->shutdown_fd, .events = POLLIN } };
+    while (w->running) {
+        if (poll(pfd, 2, SCHED_MAX_SLEEP_MS) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (pfd[1].revents & POLLIN) break; // fim de jogo
+        if (!(pfd[0].revents & POLLIN)) continue;
+        int key;
+        while ((key = getch()) != ERR) {
+            HeliCommand cmd = command_from_key(key);
+            if (cmd == CMD_NONE) continue;
+            if (w->actor) {
+                command_queue_push(&w->commands, SIM_HELI_INPUT, cmd); // aplicado pela dona
+                continue;
+            }
+            GAME_LOCK(&w->input_mutex);
+            world_queue_input(w, cmd);
+            GAME_UNLOCK(&w->input_mutex);
+        }
+    }
+    return NULL;
+}
+
+/* Um passo da máquina de estados da bateria. Nunca bloqueia, para que o
+   mesmo código sirva ao escalonador em qualquer worker e ao headless.
+   Retorna false quando a bateria deve parar de ser chamada: em recarga (o
+   timer de recarga chama battery_finish_recharge()) ou na fila da ponte
+   (o árbitro rearma o passo quando a liberar). */
+bool battery_step(World* w, Battery* self) {
+    GAME_LOCK(&self->mutex);
+    int target_x; // Variável para o destino horizontal
+    int old_x = self->x, old_y = self->y, old_status = self->status;
+    bool keep_stepping = true;
+
+    switch (self->status) {
+        case B_FIRING:
+            if (self->ammo <= 0) {
+                self->status = B_REQUESTING_BRIDGE_TO_DEPOT;
+            } else {
+                /* fora da área ativa a bateria não vê o helicóptero */
+                if (rng_below(&self->rng, 20) == 0 && grid_active(&w->grid, self->x, self->y)) {
+                    int helicopter_x, helicopter_y;
+                    GAME_LOCK(&w->helicopter.mutex);
+                    helicopter_x = w->helicopter.x;
+                    helicopter_y = w->helicopter.y;
+                    GAME_UNLOCK(&w->helicopter.mutex);
+
+                    float vector_x = helicopter_x - self->x;
+                    float vector_y = helicopter_y - self->y;
+
+                    float length = sqrt(vector_x * vector_x + vector_y * vector_y);
+                    float normalized_dx = 0, normalized_dy = -1; 
+                    if (length > 0) {
+                        normalized_dx = vector_x / length;
+                        normalized_dy = vector_y / length;
+                    }
+
+                    /* deslocamento por passo de física, para que a velocidade
+                       em células por segundo não dependa de --physics-ms; usa
+                       o período efetivo, já arredondado para ticks */
+                    long step_ms = (long)world_period_ticks(w, w->config.physics_ms) * w->config.tick_ms;
+                    float rocket_speed = ROCKET_SPEED * step_ms / ROCKET_STEP_MS;
+                    
+                    GAME_LOCK(&w->mutex_rocket_list);
+                    /* o estágio de física passa a avançar este foguete */
+                    if (rocket_spawn(&w->rockets, &w->grid, self->x, self->y - 1,
+                                     normalized_dx * rocket_speed, normalized_dy * rocket_speed,
+                                     self->id) >= 0) {
+                        self->ammo--;
+                        self->rockets_fired++;
+                    }
+                    GAME_UNLOCK(&w->mutex_rocket_list);
+                }
+            }
+            break;
+
+        // --- FASE 1: IDA PARA O DEPÓSITO ---
+        case B_REQUESTING_BRIDGE_TO_DEPOT:
+            /* apenas muda de estado; sem lock ainda */
+            self->status = B_MOVING_TO_BRIDGE;
+            break;
+
+        case B_MOVING_TO_BRIDGE: {
+            const int entry_x = BRIDGE_END_X;   /* já alinhamos B0 e B1 p/ direita */
+
+            /* 1. Caminha até a cabeceira ----------------------------- */
+            if (self->x != entry_x) {
+                self->x += (self->x < entry_x) ? 1 : -1;
+
+            } else if (self->y > BRIDGE_Y_LEVEL) {
+                self->y--;
+
+            /* 2. Na cabeceira: pede passagem ao árbitro ------------- */
+            } else {
+                /* estamos em (entry_x, BRIDGE_Y_LEVEL) */
+                if (bridge_request(w, self, BRIDGE_TO_DEPOT)) {
+                    self->status = B_ON_BRIDGE_TO_DEPOT;
+                } else {
+                    keep_stepping = false; /* na fila até o árbitro liberar */
+                }
+            }
+            break;
+        }
+
+        case B_ON_BRIDGE_TO_DEPOT:
+            target_x = BRIDGE_START_X;
+            if (self->x > target_x) self->x--;
+            else {
+                bridge_leave(w, self);
+                self->status = B_MOVING_TO_DEPOT;
+            }
+            break;
+
+        case B_MOVING_TO_DEPOT:
+            if (self->x > DEPOT_X) self->x--;
+            else if (self->y > DEPOT_Y) self->y--;
+            else {
+                self->status = B_RECHARGING;
+            }
+            break;
+
+        case B_RECHARGING:
+            /* com vaga a recarga começa já; sem vaga, espera no heap. Nos
+               dois casos o passo para até o timer de recarga disparar. */
+            depot_request(w, self);
+            keep_stepping = false;
+            break;
+        
+        /* ------------- FASE 2: volta do depósito para o combate ------------- */
+
+        /* 1) Do depósito até o início da ponte (permanece igual) */
+        case B_MOVING_FROM_DEPOT:
+            /* anda no solo até encostar na cabeceira ESQUERDA  (x = 10) */
+            if (self->x < BRIDGE_START_X)      self->x++;
+            /* depois sobe até o nível da ponte                    */
+            else if (self->y < BRIDGE_Y_LEVEL) self->y++;
+            /* chegou: pede o mutex e muda de estado                */
+            else                               self->status = B_REQUESTING_BRIDGE_TO_COMBAT;
+            break;
+
+        /* 2) Pede passagem; sem vaga, espera na fila do árbitro */
+        case B_REQUESTING_BRIDGE_TO_COMBAT:
+            if (bridge_request(w, self, BRIDGE_TO_COMBAT)) {
+                self->status = B_ON_BRIDGE_FROM_DEPOT;
+            } else {
+                keep_stepping = false;
+            }
+            break;
+
+        /* 3) ATRAVESSA a ponte — agora sempre até BRIDGE_END_X     */
+        case B_ON_BRIDGE_FROM_DEPOT: {
+            const int target_x = BRIDGE_END_X;       /*  <-- 70 (cabeceira direita)        */
+
+            if (self->x < target_x) {
+                self->x++;                           /* anda da esquerda (10) até (70)     */
+            } else {                                 /* chegou ao fim da ponte             */
+                bridge_leave(w, self);                     /* libera a ponte o mais cedo possível*/
+                self->status = B_RETURNING_TO_COMBAT;
+            }
+            break;
+        }
+
+        /* 4) Desce da ponte e solta o mutex                         */
+        case B_RETURNING_TO_COMBAT:
+            if (self->y < self->combat_y) {
+                self->y++;                           /* descendo até o chão                */
+            } else {
+                self->status = B_FINAL_POSITIONING;
+            }
+            break;
+
+        case B_FINAL_POSITIONING:
+            if (self->x != self->combat_x) {
+                if(self->x < self->combat_x) self->x++; else self->x--;
+            } else {
+                self->status = B_FIRING;
+            }
+            break;
+    }
+    grid_move(&w->grid, GRID_BATTERIES, old_x, old_y, self->x, self->y);
+    trace_battery_state(self->id, old_status, self->status);
+    GAME_UNLOCK(&self->mutex);
+    return keep_stepping;
+}
+
+/* Disparado pelo timer de recarga: reabastece e libera o depósito. */
+void battery_finish_recharge(World* w, Battery* self) {
+    GAME_LOCK(&self->mutex);
+    trace_battery_state(self->id, self->status, B_MOVING_FROM_DEPOT);
+    self->ammo = self->max_ammo;
+    self->status = B_MOVING_FROM_DEPOT;
+    self->recharge_done_ms = 0;
+    self->recharges++;
+    GAME_UNLOCK(&self->mutex);
+
+    trace_async('e', "deposito", "deposito", self->id);
+    depot_release(w);
+}
+
+/* Estágio único de física: a cada config.physics_ms avança todos os
+   foguetes ativos numa só passada, em vez de uma thread por foguete. A
+   colisão com o helicóptero é pelo segmento percorrido, então um passo
+   longo não deixa o foguete atravessá-lo sem acertar. */
+void rockets_step(World* w) {
+    SweepTarget heli;
+    bool armed = helicopter_sweep_target(w, &heli);
+    GAME_LOCK(&w->mutex_rocket_list);
+    int hit = rocket_store_step(&w->rockets, &w->grid, armed ? &heli : NULL);
+    GAME_UNLOCK(&w->mutex_rocket_list);
+    if (hit >= 0) helicopter_rocket_hit(w);
+}
+
+// --- Escalonador do modo interativo ---
+#define EXEC_TIMER_CHUNK 16  // timers por fatia do parallel-for
+#define EXEC_ROCKET_CHUNK 1  // blocos de 64 foguetes por fatia
+
+static inline uint64_t range_pack(uint32_t lo, uint32_t hi) { return (uint64_t)hi << 32 | lo; }
+
+/* Tira a próxima fatia da própria faixa; sem nada, rouba a metade final da
+   faixa de outro worker. Retorna false quando todas estão vazias. */
+static bool exec_next_slice(Scheduler* s, int me, int* lo_out, int* hi_out) {
+    int n = s->worker_count + 1;
+    _Atomic uint64_t* own = &s->ranges[me].range;
+    uint64_t r = atomic_load(own);
+    for (;;) {
+        uint32_t lo = (uint32_t)r, hi = (uint32_t)(r >> 32);
+        if (lo < hi) {
+            uint32_t end = hi - lo > (uint32_t)s->job_chunk ? lo + s->job_chunk : hi;
+            if (atomic_compare_exchange_weak(own, &r, range_pack(end, hi))) {
+                *lo_out = lo;
+                *hi_out = end;
+                return true;
+            }
+            continue;
+        }
+        bool stolen = false;
+        for (int k = 1; k < n && !stolen; k++) {
+            _Atomic uint64_t* victim = &s->ranges[(me + k) % n].range;
+            uint64_t v = atomic_load(victim);
+            uint32_t vlo = (uint32_t)v, vhi = (uint32_t)(v >> 32);
+            if (vlo >= vhi) continue;
+            uint32_t mid = vlo + (vhi - vlo) / 2; // com um só item, leva o item
+            if (atomic_compare_exchange_strong(victim, &v, range_pack(vlo, mid))) {
+                r = range_pack(mid, vhi);
+                atomic_store(own, r);
+                stolen = true;
+            }
+        }
+        if (!stolen) return false;
+    }
+}
+
+static void exec_run(Scheduler* s, int me) {
+    int lo, hi;
+    while (exec_next_slice(s, me, &lo, &hi)) s->job_fn(s, me, lo, hi);
+}
+
+static void* scheduler_worker_func(void* arg) {
+    Scheduler* s = arg;
+    uint64_t seen = 0;
+    int me = atomic_fetch_add(&s->next_index, 1);
+    trace_thread_name("worker");
+    pthread_mutex_lock(&s->mutex);
+    for (;;) {
+        while (s->round == seen && !s->stop) pthread_cond_wait(&s->start, &s->mutex);
+        if (s->stop) break;
+        seen = s->round;
+        pthread_mutex_unlock(&s->mutex);
+        uint64_t start = trace_begin();
+        exec_run(s, me);
+        trace_span("tick", "fatias", start, NULL, 0);
+        pthread_mutex_lock(&s->mutex);
+        if (--s->busy == 0) pthread_cond_signal(&s->done);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+/* Roda fn sobre [0, n) em fatias de 'chunk', repartindo a faixa igualmente
+   entre os workers e a thread atual; quem termina antes rouba dos outros.
+   Volta só quando todos terminaram (barreira entre fases). */
+static void scheduler_parallel_for(Scheduler* s, int n, int chunk, RangeFn fn) {
+    int parts = s->worker_count + 1;
+    s->job_fn = fn;
+    s->job_chunk = chunk;
+    for (int i = 0; i < parts; i++) {
+        atomic_store(&s->ranges[i].range,
+                     range_pack((uint32_t)((long)n * i / parts), (uint32_t)((long)n * (i + 1) / parts)));
+    }
+    if (s->worker_count == 0) {
+        exec_run(s, 0);
+        return;
+    }
+    pthread_mutex_lock(&s->mutex);
+    s->busy = s->worker_count;
+    s->round++;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->mutex);
+    exec_run(s, 0);
+    pthread_mutex_lock(&s->mutex);
+    while (s->busy > 0) pthread_cond_wait(&s->done, &s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* Fase de simulação: máquinas de estado das baterias e fins de recarga. */
+static void exec_fire_timers(Scheduler* s, int worker, int lo, int hi) {
+    (void)worker;
+    World* w = s->world;
+    for (int i = lo; i < hi; i++) timer_fire(w, w->due[s->job_first + i]);
+}
+
+/* Fase de colisão: integra os blocos de foguetes e anota os que saíram da
+   área no rascunho do worker; a liberação é serial, depois da barreira. */
+static void exec_step_rockets(Scheduler* s, int worker, int lo, int hi) {
+    World* w = s->world;
+    WorkerScratch* sc = &s->scratch[worker];
+    sc->culled_count += rocket_store_step_blocks(&w->rockets, &w->grid, lo, hi, s->sweep,
+                                                 sc->culled + sc->culled_count, &sc->hit);
+}
+
+/* Um tick com muitos timers: simula todas as entidades em paralelo, espera
+   todos, e só então integra os foguetes (inclusive os recém-disparados). */
+static void scheduler_parallel_tick(Scheduler* s) {
+    World* w = s->world;
+    Timer* rockets = w->due_count > 0 && w->due[0]->kind == TIMER_ROCKETS ? w->due[0] : NULL;
+    s->job_first = rockets ? 1 : 0;
+    uint64_t start = trace_begin();
+    scheduler_parallel_for(s, w->due_count - s->job_first, EXEC_TIMER_CHUNK, exec_fire_timers);
+    trace_span("tick", "simular", start, "timers", w->due_count - s->job_first);
+    if (!rockets) return;
+
+    start = trace_begin();
+    SweepTarget heli;
+    s->sweep = helicopter_sweep_target(w, &heli) ? &heli : NULL;
+    GAME_LOCK(&w->mutex_rocket_list);
+    for (int i = 0; i <= s->worker_count; i++) {
+        s->scratch[i].culled_count = 0;
+        s->scratch[i].hit = -1;
+    }
+    scheduler_parallel_for(s, w->rockets.capacity / 64, EXEC_ROCKET_CHUNK, exec_step_rockets);
+    bool hit = false;
+    for (int i = 0; i <= s->worker_count; i++) {
+        for (int k = 0; k < s->scratch[i].culled_count; k++) {
+            rocket_release(&w->rockets, &w->grid, s->scratch[i].culled[k]);
+        }
+        hit |= s->scratch[i].hit >= 0;
+    }
+    GAME_UNLOCK(&w->mutex_rocket_list);
+    s->sweep = NULL;
+    if (hit) helicopter_rocket_hit(w);
+    world_arm_timer(w, rockets, rockets->expires + world_period_ticks(w, w->config.physics_ms));
+    trace_span("tick", "colidir", start, NULL, 0);
+}
+
+bool scheduler_start(Scheduler* s, World* w, int worker_count, struct HeliPolicy* policy) {
+    s->world = w;
+    s->policy = policy;
+    s->worker_count = worker_count;
+    s->workers = calloc(worker_count ? worker_count : 1, sizeof(pthread_t));
+    s->ranges = aligned_alloc(64, (worker_count + 1) * sizeof(WorkerRange));
+    s->scratch = calloc(worker_count + 1, sizeof(WorkerScratch));
+    if (!s->workers || !s->ranges || !s->scratch) { perror("calloc"); return false; }
+    for (int i = 0; i <= worker_count; i++) {
+        s->scratch[i].culled = calloc(w->rockets.capacity ? w->rockets.capacity : 1, sizeof(int));
+        if (!s->scratch[i].culled) { perror("calloc"); return false; }
+    }
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->done, NULL);
+    s->round = 0;
+    s->busy = 0;
+    s->stop = false;
+    s->single_writer = w->actor;
+    s->unpaced = false;
+    s->tick_limit = UINT64_MAX;
+    s->timers_fired = 0;
+    atomic_init(&s->next_index, 1);
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&s->workers[i], NULL, scheduler_worker_func, s) != 0) {
+            perror("Failed to create scheduler worker");
+            s->worker_count = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+void scheduler_stop(Scheduler* s) {
+    pthread_mutex_lock(&s->mutex);
+    s->stop = true;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->mutex);
+    for (int i = 0; i < s->worker_count; i++) pthread_join(s->workers[i], NULL);
+    free(s->workers);
+    for (int i = 0; i <= s->worker_count; i++) free(s->scratch[i].culled);
+    free(s->scratch);
+    free(s->ranges);
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->start);
+    pthread_mutex_destroy(&s->mutex);
+}
+
+/* Publica um quadro depois de um tick (force) ou de um passo da thread do
+   helicóptero ainda não publicado. É o único ponto de publicação enquanto
+   essa thread roda: aqui baterias e foguetes estão parados. */
+static void scheduler_publish(World* w, bool force) {
+    unsigned pending = atomic_exchange(&w->heli_pending, 0);
+    if (force || pending) world_publish_snapshot(w);
+    if (pending & HELI_MOVED) world_kick_render(w);
+}
+
+/* Dorme até o próximo tick com timers (ticks vazios não acordam ninguém),
+   dispara todos os vencidos de uma vez e publica um único snapshot. */
+void* scheduler_thread_func(void* arg) {
+    Scheduler* s = arg;
+    World* w = s->world;
+    long wall_epoch_ms = monotonic_ms();
+    trace_thread_name("escalonador");
+    lock_elided = s->single_writer;
+    w->timer_epoch_ms = sim_now_ms(w);
+    world_start_timers(w, s->policy != NULL);
+    /* no modo ator a caixa de comandos é esvaziada ao menos uma vez por tick;
+       com a thread do helicóptero, o passo dele sai no quadro seguinte */
+    long max_sleep_ms = s->single_writer || !s->policy ? w->config.tick_ms : SCHED_MAX_SLEEP_MS;
+
+    while (w->running) {
+        if (s->single_writer) world_apply_commands(w);
+        GAME_LOCK(&w->timer_mutex);
+        uint64_t next = wheel_next_tick(&w->timers, s->tick_limit);
+        GAME_UNLOCK(&w->timer_mutex);
+        if (next >= s->tick_limit) break;
+
+        long wait_ms = max_sleep_ms;
+        if (next != UINT64_MAX) {
+            long due_ms = wall_epoch_ms + (long)next * w->config.tick_ms;
+            wait_ms = due_ms - monotonic_ms();
+        }
+        if (wait_ms > 0 && !s->unpaced) {
+            scheduler_publish(w, false);
+            world_sleep(w, wait_ms < max_sleep_ms ? wait_ms : max_sleep_ms);
+            continue;
+        }
+
+        GAME_LOCK(&w->timer_mutex);
+        w->timers.now = next;
+        GAME_UNLOCK(&w->timer_mutex);
+        if (w->deterministic) w->clock_ms = (long)next * w->config.tick_ms;
+        world_collect_due(w);
+        if (w->due_count == 0) continue;
+
+        uint64_t start = trace_begin();
+        s->timers_fired += w->due_count;
+        if (s->policy || s->single_writer) {
+            /* gravação/replay e modo ator: mesma ordem do headless, nesta thread */
+            for (int i = 0; i < w->due_count; i++) {
+                Timer* t = w->due[i];
+                if (t->kind != TIMER_HELICOPTER) timer_fire(w, t);
+                else if (!world_helicopter_tick(w, s->policy, t)) break;
+            }
+        } else if (s->worker_count > 0 && w->due_count >= SCHED_PARALLEL_MIN) {
+            scheduler_parallel_tick(s);
+        } else {
+            for (int i = 0; i < w->due_count; i++) timer_fire(w, w->due[i]);
+        }
+        scheduler_publish(w, true);
+        trace_span("tick", "tick", start, "timers", w->due_count);
+    }
+    scheduler_publish(w, false); // último passo do helicóptero
+    lock_elided = false;
+    return NULL;
+}
+
+// --- Renderização (buffer fora da tela + diff) ---
+typedef struct {
+    char cells[SCREEN_HEIGHT][SCREEN_WIDTH];
+} Frame;
+
+static void frame_put(Frame* f, int y, int x, char c) {
+    if (y >= 0 && y < SCREEN_HEIGHT && x >= 0 && x < SCREEN_WIDTH) f->cells[y][x] = c;
+}
+
+static void frame_puts(Frame* f, int y, int x, const char* str) {
+    for (; *str; str++, x++) frame_put(f, y, x, *str);
+}
+
+/* Origem da janela no mapa. Começa em (0,0), sobre o cenário, e só anda
+   quando o helicóptero chega a menos de uma margem da beirada da janela;
+   nunca passa da borda do mapa. Com o mapa do tamanho da tela fica parada. */
+#define CAMERA_MARGIN_X 10
+#define CAMERA_MARGIN_Y 4
+
+typedef struct {
+    int x, y;
+} Camera;
+
+static int camera_axis(int cam, int focus, int margin, int screen, int map) {
+    if (focus - cam < margin) cam = focus - margin;
+    if (focus - cam >= screen - margin) cam = focus - screen + margin + 1;
+    if (cam > map - screen) cam = map - screen;
+    return cam < 0 ? 0 : cam;
+}
+
+static void camera_follow(Camera* cam, const WorldSnapshot* snap) {
+    cam->x = camera_axis(cam->x, snap->heli_x, CAMERA_MARGIN_X, SCREEN_WIDTH, snap->map_width);
+    cam->y = camera_axis(cam->y, snap->heli_y, CAMERA_MARGIN_Y, SCREEN_HEIGHT, snap->map_height);
+}
+
+// Célula do mapa em coordenadas do mundo; o que cai fora da janela é descartado
+static void view_put(Frame* f, const Camera* cam, int y, int x, char c) {
+    frame_put(f, y - cam->y, x - cam->x, c);
+}
+
+static const char* battery_status_str(int status) {
+    switch (status) {
+        case B_FIRING:                       return "ATIRANDO     ";
+        case B_REQUESTING_BRIDGE_TO_DEPOT:   return "AGUARD. PONTE";
+        case B_MOVING_TO_BRIDGE:             return "INDO P/ PONTE";
+        case B_ON_BRIDGE_TO_DEPOT:           return "NA PONTE -> D";
+        case B_MOVING_TO_DEPOT:              return "SAINDO P/ DEP";
+        case B_RECHARGING:                   return "RECARREGANDO ";
+        case B_MOVING_FROM_DEPOT:            return "VOLTANDO PNT ";
+        case B_REQUESTING_BRIDGE_TO_COMBAT:  return "AGUARD. PONTE";
+        case B_ON_BRIDGE_FROM_DEPOT:         return "NA PONTE -> C";
+        case B_RETURNING_TO_COMBAT:          return "SAINDO P/ CMB";
+        case B_FINAL_POSITIONING:            return "POS. FINAL   ";
+    }
+    return "UNKNOWN";
+}
+
+/* Monta o quadro inteiro na memória a partir de um snapshot: o renderer
+   não toca em nenhum lock da simulação. O mundo é desenhado pela câmera
+   (só a janela visível do mapa), que é atualizada aqui; o HUD fica fixo
+   na tela. */
+void render_build_frame(const WorldSnapshot* snap, Camera* camera, Frame* f) {
+    char text[SCREEN_WIDTH + 1];
+    memset(f->cells, ' ', sizeof(f->cells));
+    camera_follow(camera, snap);
+    const Camera cam = *camera;
+
+    // Borda do mapa, só nos trechos que caem na janela
+    for (int i = cam.x; i < cam.x + SCREEN_WIDTH; ++i) {
+        view_put(f, &cam, 0, i, '-');
+        view_put(f, &cam, snap->map_height - 1, i, '-');
+    }
+    for (int i = cam.y; i < cam.y + SCREEN_HEIGHT; ++i) {
+        if (i == 0 || i == snap->map_height - 1) continue;
+        view_put(f, &cam, i, 0, '|');
+        view_put(f, &cam, i, snap->map_width - 1, '|');
+    }
+
+    view_put(f, &cam, ORIGIN_Y, ORIGIN_X, snap->soldiers_at_origin > 0 ? SOLDIER_CHAR : PLATFORM_CHAR);
+    view_put(f, &cam, PLATFORM_Y, PLATFORM_X, PLATFORM_CHAR);
+    view_put(f, &cam, DEPOT_Y, DEPOT_X, DEPOT_CHAR);
+    for (int x = BRIDGE_START_X; x <= BRIDGE_END_X; ++x) view_put(f, &cam, BRIDGE_Y_LEVEL, x, BRIDGE_CHAR);
+
+    // Helicóptero ('X' = explosão)
+    view_put(f, &cam, snap->heli_y, snap->heli_x, snap->heli_status != H_EXPLODED ? HELICOPTER_CHAR : 'X');
+
+    // HUD
+    snprintf(text, sizeof text, "Soldados a Bordo: %d | Resgatados: %d/%d | Restam na Ilha: %d",
+             snap->soldiers_on_board, snap->soldiers_rescued_total, snap->soldiers_to_win,
+             snap->soldiers_at_origin);
+    frame_puts(f, SCREEN_HEIGHT - 1, SCREEN_WIDTH / 2 - 25, text);
+
+    // Baterias
+    int firing = 0, recharging = 0, total_ammo = 0;
+    for (int i = 0; i < snap->battery_count; i++) {
+        const BatterySnapshot* b = &snap->batteries[i];
+        view_put(f, &cam, b->y, b->x, BATTERY_CHAR);
+        view_put(f, &cam, b->y, b->x + 1, '0' + b->id % 10);
+        firing += b->status == B_FIRING;
+        recharging += b->status == B_RECHARGING;
+        total_ammo += b->ammo;
+        if (snap->battery_count <= 2) {
+            snprintf(text, sizeof text, "B%d: Ammo %2d/%-2d | Status: %s",
+                     i, b->ammo, b->max_ammo, battery_status_str(b->status));
+            frame_puts(f, 0, 5 + i * 25, text);
+        }
+    }
+    if (snap->battery_count > 2) { // resumo quando não cabe uma linha por bateria
+        snprintf(text, sizeof text, "Bat %d|Atirando %d|Recarga %d|Municao %d|Fila ponte %d",
+                 snap->battery_count, firing, recharging, total_ammo, snap->bridge_queue);
+        frame_puts(f, 0, 5, text);
+    }
+
+    // Foguetes
+    for (int i = 0; i < snap->rocket_count; i++) {
+        view_put(f, &cam, snap->rockets[i].y, snap->rockets[i].x, ROCKET_CHAR);
+    }
+}
+
+/* Envia ao terminal só as células que mudaram em relação ao quadro
+   anterior. Retorna quantas células foram escritas (0 = nada a fazer). */
+int render_present(const Frame* cur, const Frame* prev) {
+    int emitted = 0;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        if (memcmp(cur->cells[y], prev->cells[y], SCREEN_WIDTH) == 0) continue;
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            if (cur->cells[y][x] != prev->cells[y][x]) {
+                mvaddch(y, x, cur->cells[y][x]);
+                emitted++;
+            }
+        }
+    }
+    if (emitted > 0) refresh();
+    return emitted;
+}
+
+/* Saída ANSI direta: o diff do quadro vira uma sequência de escapes montada
+   num buffer e enviada com um único write(). O cursor só é reposicionado
+   (CSI linha;colunaH) quando não dá para chegar reescrevendo poucas células
+   iguais; trechos alterados próximos viram uma corrida só. */
+#define ANSI_MAX_GAP 6 // até aqui, reescrever células iguais custa menos que mover o cursor
+
+typedef struct {
+    int fd;
+    int cur_y, cur_x;  // onde o terminal deixou o cursor (-1 = desconhecido)
+    size_t len;
+    long bytes;        // total escrito (benchmark)
+    char buf[SCREEN_HEIGHT * SCREEN_WIDTH * 10];
+} AnsiOut;
+
+void ansi_out_init(AnsiOut* o, int fd) {
+    o->fd = fd;
+    o->cur_y = o->cur_x = -1;
+    o->len = 0;
+    o->bytes = 0;
+}
+
+static bool ansi_flush(AnsiOut* o) {
+    size_t off = 0;
+    while (off < o->len) {
+        ssize_t n = write(o->fd, o->buf + off, o->len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            o->cur_y = o->cur_x = -1;
+            return false;
+        }
+        off += (size_t)n;
+    }
+    o->bytes += (long)o->len;
+    o->len = 0;
+    return true;
+}
+
+/* Mesmo contrato de render_present, pela saída ANSI. */
+int render_present_ansi(AnsiOut* o, const Frame* cur, const Frame* prev) {
+    int emitted = 0;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        const char* row = cur->cells[y];
+        if (memcmp(row, prev->cells[y], SCREEN_WIDTH) == 0) continue;
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            if (row[x] == prev->cells[y][x]) continue;
+            if (o->cur_y == y && o->cur_x <= x && x - o->cur_x <= ANSI_MAX_GAP) {
+                /* emenda a corrida: reescreve as células iguais do intervalo */
+                memcpy(o->buf + o->len, row + o->cur_x, x - o->cur_x);
+                o->len += x - o->cur_x;
+            } else {
+                o->len += sprintf(o->buf + o->len, "\033[%d;%dH", y + 1, x + 1);
+            }
+            o->buf[o->len++] = row[x];
+            emitted++;
+            /* na última coluna o terminal fica no estado de quebra pendente */
+            o->cur_y = y;
+            o->cur_x = x + 1 < SCREEN_WIDTH ? x + 1 : -1;
+            if (o->cur_x < 0) o->cur_y = -1;
+        }
+    }
+    if (emitted > 0) ansi_flush(o);
+    return emitted;
+}
+
+void* game_manager_thread_func(void* arg) {
+    World* w = ((RenderThreadArg*)arg)->world;
+    SnapshotChannel* channel = ((RenderThreadArg*)arg)->channel;
+    RenderBackend backend = ((RenderThreadArg*)arg)->backend;
+    static Frame frames[2];
+    static AnsiOut ansi;
+    Camera camera = { 0, 0 };
+    ansi_out_init(&ansi, ((RenderThreadArg*)arg)->out_fd);
+    int cur = 0;
+    memset(frames[1].cells, 0, sizeof(frames[1].cells)); // força o primeiro quadro completo
+    trace_thread_name("render");
+
+    while (w->running) {
+        const WorldSnapshot* snap;
+        if (snapshot_acquire(channel, &snap)) { // sem snapshot novo = nada mudou
+            if (snap->game_over) {
+                world_shutdown(w);
+                break;
+            }
+            uint64_t start = trace_begin();
+            render_build_frame(snap, &camera, &frames[cur]);
+            if (lock_stats_enabled) {
+                char text[SCREEN_WIDTH - 3];
+                lock_stats_hud(text, sizeof text);
+                frame_puts(&frames[cur], 1, 2, text);
+            }
+            int emitted = backend == RENDER_ANSI ? render_present_ansi(&ansi, &frames[cur], &frames[cur ^ 1])
+                                                 : render_present(&frames[cur], &frames[cur ^ 1]);
+            if (emitted > 0) {
+                cur ^= 1; // o quadro mostrado vira a referência do próximo diff
+                atomic_store_explicit(&w->presented_heli, (uint64_t)(uint32_t)snap->heli_x << 32 | (uint32_t)snap->heli_y,
+                                      memory_order_release);
+            }
+            trace_span("render", "quadro", start, "celulas", emitted);
+        }
+        world_wait_render(w, RENDER_STEP_MS);
+    }
+    return NULL;
+}
+
+// --- Benchmark das saídas (--bench-render) ---
+#define BENCH_RENDER_MAX_FRAMES 5000
+
+typedef struct {
+    SnapshotChannel* channel;
+    Camera camera;
+    Frame* frames;
+    int count;
+} FrameRecorder;
+
+/* Observador da política: um quadro por passo do helicóptero. */
+static void record_frame(World* w, void* ctx) {
+    FrameRecorder* rec = ctx;
+    const WorldSnapshot* snap;
+    if (rec->count == BENCH_RENDER_MAX_FRAMES) return;
+    world_publish_snapshot(w);
+    if (snapshot_acquire(rec->channel, &snap)) render_build_frame(snap, &rec->camera, &rec->frames[rec->count++]);
+}
+
+/* Passa todos os quadros por uma saída, cada um em diff contra o anterior
+   (o primeiro contra um quadro vazio, como no jogo), e devolve o tempo. */
+static double bench_present(const Frame* frames, int n, RenderBackend backend, AnsiOut* ansi) {
+    static const Frame blank;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < n; i++) {
+        const Frame* prev = i > 0 ? &frames[i - 1] : &blank;
+        if (backend == RENDER_ANSI) render_present_ansi(ansi, &frames[i], prev);
+        else render_present(&frames[i], prev);
+    }
+    return elapsed_s(&t0);
+}
+
+typedef struct {
+    int frames;
+    const char* term;
+    double curses_bytes, curses_us; // por quadro
+    double ansi_bytes, ansi_us;
+} RenderBenchResult;
+
+/* Repete a passada pelos quadros até somar min_s (ao menos uma) e devolve o
+   tempo médio de uma passada. */
+static double bench_present_passes(const Frame* frames, int n, RenderBackend backend, AnsiOut* ansi, double min_s) {
+    double total_s = 0;
+    int passes = 0;
+    do {
+        total_s += bench_present(frames, n, backend, ansi);
+        passes++;
+    } while (total_s < min_s);
+    return total_s / passes;
+}
+
+/* Grava os quadros de uma partida headless (autopilot) e mede as duas
+   saídas sobre eles, escrevendo num arquivo temporário em vez da tela. Os
+   bytes são os da primeira passada; o tempo, a média de quantas passadas
+   couberem em min_s. */
+static bool render_bench_measure(const Options* opt, double min_s, RenderBenchResult* r) {
+    World* w = calloc(1, sizeof(World));
+    FrameRecorder rec = { .frames = calloc(BENCH_RENDER_MAX_FRAMES, sizeof(Frame)) };
+    if (!w || !rec.frames) { perror("calloc"); return false; }
+    w->headless = true;
+    w->config = opt->world;
+    w->difficulty = opt->difficulty ? opt->difficulty : 2;
+    w->seed = opt->seed;
+    init_game_elements(w);
+    rec.channel = snapshot_channel_create(w);
+    HeliPolicy policy = { .kind = POLICY_AUTOPILOT, .world = w,
+                          .observer = record_frame, .observer_ctx = &rec };
+    rng_seed(&policy.rng, w->seed, RNG_STREAM_POLICY);
+    world_run_headless(w, &policy, opt->max_ticks);
+
+    FILE* curses_sink = tmpfile();
+    FILE* ansi_sink = tmpfile();
+    FILE* no_input = fopen("/dev/null", "r");
+    if (!curses_sink || !ansi_sink || !no_input) { perror("tmpfile"); return false; }
+    const char* term = getenv("TERM");
+    r->term = term && *term ? term : "xterm";
+    SCREEN* scr = newterm(r->term, curses_sink, no_input);
+    if (!scr) { fprintf(stderr, "newterm falhou\n"); return false; }
+    curs_set(0);
+    double curses_s = bench_present(rec.frames, rec.count, RENDER_CURSES, NULL);
+    fflush(curses_sink);
+    long curses_bytes = ftell(curses_sink);
+    if (curses_s < min_s) curses_s = bench_present_passes(rec.frames, rec.count, RENDER_CURSES, NULL, min_s);
+    endwin();
+    delscreen(scr);
+
+    static AnsiOut ansi;
+    ansi_out_init(&ansi, fileno(ansi_sink));
+    double ansi_s = bench_present(rec.frames, rec.count, RENDER_ANSI, &ansi);
+    long ansi_bytes = ansi.bytes;
+    if (ansi_s < min_s) ansi_s = bench_present_passes(rec.frames, rec.count, RENDER_ANSI, &ansi, min_s);
+
+    int n = rec.count ? rec.count : 1;
+    r->frames = rec.count;
+    r->curses_bytes = (double)curses_bytes / n;
+    r->curses_us = curses_s * 1e6 / n;
+    r->ansi_bytes = (double)ansi_bytes / n;
+    r->ansi_us = ansi_s * 1e6 / n;
+
+    fclose(curses_sink);
+    fclose(ansi_sink);
+    fclose(no_input);
+    free(rec.frames);
+    cleanup_game_resources(w);
+    free(w);
+    return true;
+}
+
+int run_render_bench(const Options* opt) {
+    RenderBenchResult r;
+    if (!render_bench_measure(opt, 0, &r)) return 1;
+    printf("Quadros: %d (terminal %s)\n", r.frames, r.term);
+    printf("curses: %8.1f bytes/quadro | %7.2f us/quadro\n", r.curses_bytes, r.curses_us);
+    printf("ansi:   %8.1f bytes/quadro | %7.2f us/quadro\n", r.ansi_bytes, r.ansi_us);
+    return 0;
+}
+
+// --- Espectador do anel compartilhado (--spectate) ---
+typedef struct {
+    ShmHeader* hdr;
+    size_t bytes;
+    ShmFrame* frame;  // cópia local de um slot
+    uint64_t next;    // próximo quadro a ler em ordem (modo gravador)
+    long read, lost;  // lost: sobrescritos pelo escritor antes da leitura
+} ShmReader;
+
+static bool shm_reader_open(ShmReader* rd, const char* name) {
+    char path[64];
+    memset(rd, 0, sizeof(*rd));
+    shm_object_name(path, sizeof path, name);
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) { perror(path); return false; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); close(fd); return false; }
+    rd->bytes = (size_t)st.st_size;
+    rd->hdr = rd->bytes >= sizeof(ShmHeader) ? mmap(NULL, rd->bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (rd->hdr == MAP_FAILED) { fprintf(stderr, "%s: objeto invalido\n", path); return false; }
+    const ShmHeader* hdr = rd->hdr;
+    if (atomic_load_explicit(&rd->hdr->magic, memory_order_acquire) != SHM_MAGIC || hdr->version != SHM_VERSION ||
+        hdr->slot_bytes < shm_slot_bytes(hdr->max_batteries, hdr->max_rockets) ||
+        rd->bytes < sizeof(ShmHeader) + (size_t)hdr->slot_count * hdr->slot_bytes) {
+        fprintf(stderr, "%s: cabecalho de anel invalido\n", path);
+        munmap(rd->hdr, rd->bytes);
+        return false;
+    }
+    rd->frame = malloc(hdr->slot_bytes);
+    if (!rd->frame) { perror("malloc"); munmap(rd->hdr, rd->bytes); return false; }
+    return true;
+}
+
+static void shm_reader_close(ShmReader* rd) {
+    free(rd->frame);
+    munmap(rd->hdr, rd->bytes);
+}
+
+/* Copia o quadro 'index' para rd->frame sem travar nada. Retorna false se
+   o escritor estava nele ou já o sobrescreveu com um mais novo. */
+static bool shm_reader_copy(ShmReader* rd, uint64_t index) {
+    const ShmFrame* f = shm_slot(rd->hdr, index);
+    uint64_t before = atomic_load_explicit(&f->seq, memory_order_acquire);
+    if (before & 1) return false;
+    memcpy(rd->frame, f, rd->hdr->slot_bytes);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&f->seq, memory_order_relaxed) == before && rd->frame->index == index;
+}
+
+/* Converte a cópia local em WorldSnapshot (com os vetores de 'snap'). */
+static void shm_frame_to_snapshot(const ShmReader* rd, WorldSnapshot* snap) {
+    const ShmFrame* f = rd->frame;
+    snap->seq = f->index + 1;
+    snap->clock_ms = (long)f->clock_ms;
+    snap->heli_x = f->heli_x;
+    snap->heli_y = f->heli_y;
+    snap->heli_status = f->heli_status;
+    snap->soldiers_on_board = f->soldiers_on_board;
+    snap->soldiers_rescued_total = f->soldiers_rescued_total;
+    snap->soldiers_at_origin = f->soldiers_at_origin;
+    snap->soldiers_to_win = f->soldiers_to_win;
+    snap->map_width = rd->hdr->map_width;
+    snap->map_height = rd->hdr->map_height;
+    snap->bridge_queue = f->bridge_queue;
+    snap->game_over = f->game_over;
+    snap->victory = f->victory;
+    snap->battery_count = f->battery_count < rd->hdr->max_batteries ? f->battery_count : rd->hdr->max_batteries;
+    snap->rocket_count = f->rocket_count < rd->hdr->max_rockets ? f->rocket_count : rd->hdr->max_rockets;
+    const ShmBattery* b = (const ShmBattery*)(f + 1);
+    for (int i = 0; i < snap->battery_count; i++) {
+        snap->batteries[i] = (BatterySnapshot){ .id = i, .x = b[i].x, .y = b[i].y, .ammo = b[i].ammo,
+                                                .max_ammo = b[i].max_ammo, .status = b[i].status };
+    }
+    const ShmRocket* rk = (const ShmRocket*)(b + f->battery_count);
+    for (int i = 0; i < snap->rocket_count; i++) snap->rockets[i] = (RocketSnapshot){ rk[i].x, rk[i].y };
+}
+
+/* Gravador: lê todos os quadros em ordem e escreve uma linha CSV por
+   quadro. Se ficar mais de SHM_RING_SLOTS atrás, pula para o mais antigo
+   ainda no anel e conta os perdidos. */
+static void spectate_record(ShmReader* rd, WorldSnapshot* snap) {
+    printf("quadro,clock_ms,heli_x,heli_y,heli_status,a_bordo,resgatados,na_ilha,foguetes,municao\n");
+    for (;;) {
+        bool closed = atomic_load_explicit(&rd->hdr->closed, memory_order_acquire);
+        uint64_t published = atomic_load_explicit(&rd->hdr->published, memory_order_acquire);
+        if (published - rd->next > rd->hdr->slot_count) {
+            rd->lost += (long)(published - rd->hdr->slot_count - rd->next);
+            rd->next = published - rd->hdr->slot_count;
+        }
+        for (; rd->next < published; rd->next++) {
+            if (!shm_reader_copy(rd, rd->next)) { rd->lost++; continue; }
+            shm_frame_to_snapshot(rd, snap);
+            int ammo = 0;
+            for (int i = 0; i < snap->battery_count; i++) ammo += snap->batteries[i].ammo;
+            printf("%llu,%ld,%d,%d,%d,%d,%d,%d,%d,%d\n", (unsigned long long)(snap->seq - 1), snap->clock_ms,
+                   snap->heli_x, snap->heli_y, snap->heli_status, snap->soldiers_on_board,
+                   snap->soldiers_rescued_total, snap->soldiers_at_origin, snap->rocket_count, ammo);
+            rd->read++;
+        }
+        if (closed) break;
+        usleep(1000);
+    }
+}
+
+/* Visualizador: a cada RENDER_STEP_MS desenha o quadro mais novo com o
+   mesmo renderizador do jogo. 'q' sai. */
+static void spectate_view(ShmReader* rd, WorldSnapshot* snap, RenderBackend backend) {
+    static Frame frames[2];
+    static AnsiOut ansi;
+    Camera camera = { 0, 0 };
+    int cur = 0;
+    uint64_t shown = 0;
+    ansi_out_init(&ansi, STDOUT_FILENO);
+    memset(frames[1].cells, 0, sizeof(frames[1].cells));
+    initscr();
+    cbreak();
+    noecho();
+    curs_set(0);
+    nodelay(stdscr, TRUE);
+    while (getch() != 'q' && !atomic_load_explicit(&rd->hdr->closed, memory_order_acquire)) {
+        uint64_t published = atomic_load_explicit(&rd->hdr->published, memory_order_acquire);
+        if (published > shown && shm_reader_copy(rd, published - 1)) {
+            shown = published;
+            rd->read++;
+            shm_frame_to_snapshot(rd, snap);
+            render_build_frame(snap, &camera, &frames[cur]);
+            int emitted = backend == RENDER_ANSI ? render_present_ansi(&ansi, &frames[cur], &frames[cur ^ 1])
+                                                 : render_present(&frames[cur], &frames[cur ^ 1]);
+            if (emitted > 0) cur ^= 1;
+        }
+        usleep(RENDER_STEP_MS * 1000);
+    }
+    endwin();
+}
+
+int run_spectate(const Options* opt) {
+    ShmReader rd;
+    if (!shm_reader_open(&rd, opt->spectate_name)) return 1;
+    WorldSnapshot snap = { 0 };
+    snap.batteries = calloc(rd.hdr->max_batteries ? rd.hdr->max_batteries : 1, sizeof(BatterySnapshot));
+    snap.rockets = calloc(rd.hdr->max_rockets ? rd.hdr->max_rockets : 1, sizeof(RocketSnapshot));
+    if (!snap.batteries || !snap.rockets) { perror("calloc"); return 1; }
+
+    if (opt->headless) spectate_record(&rd, &snap);
+    else spectate_view(&rd, &snap, opt->render);
+    fprintf(stderr, "Espectador: %ld quadros lidos, %ld perdidos\n", rd.read, rd.lost);
+
+    free(snap.batteries);
+    free(snap.rockets);
+    shm_reader_close(&rd);
+    return 0;
+}
+
+// --- Suíte de benchmarks (--bench) ---
+#define BENCH_VERSION 1
+#define BENCH_MAX_METRICS 128
+#define BENCH_REPEATS 5      // cada ponto fica com a melhor de N rodadas (o ruído só atrasa), após um aquecimento
+#define BENCH_MIN_WALL_S 0.1 // e cada rodada repete a carga até durar ao menos isso
+#define BENCH_LATENCY_SAMPLES 40
+#define BENCH_LATENCY_TIMEOUT_MS 2000
+#define BENCH_LATENCY_FACTOR 3 // a fase do timer do helicóptero domina a latência: tolerância maior
+#define BENCH_SCALING_BATTERIES 2048 // acima de SCHED_PARALLEL_MIN: o escalonador divide o tick
+
+#if defined(__AVX2__)
+#define BENCH_SIMD "avx2"
+#elif defined(__SSE2__)
+#define BENCH_SIMD "sse2"
+#else
+#define BENCH_SIMD "escalar"
+#endif
+
+static const int bench_battery_counts[] = { 2, 64, 1024 };
+static const int bench_rocket_slots[] = { 20, 512 };
+
+/* Métricas planas, uma por linha no JSON, para que a comparação com a base
+   seja só casar nomes. Só vazões e custos medidos entram no veredito; as
+   contagens por tick (determinísticas para a semente) e as razões derivadas
+   de outras métricas são só mostradas, para que uma rodada ruidosa não conte
+   como várias regressões. */
+typedef enum {
+    BENCH_RATE, // vazão: maior é melhor
+    BENCH_COST, // tempo ou bytes: menor é melhor
+    BENCH_INFO, // contagem determinística ou valor derivado: sem veredito
+} BenchKind;
+
+typedef struct {
+    char name[64];
+    double value;
+    BenchKind kind;
+} BenchMetric;
+
+typedef struct {
+    BenchMetric m[BENCH_MAX_METRICS];
+    int count;
+} BenchReport;
+
+static void bench_metric(BenchReport* r, BenchKind kind, double value, const char* fmt, ...) {
+    if (r->count == BENCH_MAX_METRICS) return;
+    BenchMetric* m = &r->m[r->count++];
+    m->kind = kind;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(m->name, sizeof m->name, fmt, ap);
+    va_end(ap);
+    m->value = value;
+    fprintf(stderr, "  %-44s %14.2f\n", m->name, value);
+}
+
+static int bench_compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double bench_median(double* v, int n) {
+    qsort(v, n, sizeof *v, bench_compare_double);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+
+/* Partidas headless em sequência (autopilot, semente seed + i) até somar
+   'ticks' ticks simulados e BENCH_MIN_WALL_S; na escala, várias threads
+   rodam a mesma carga. */
+typedef struct {
+    const Options* opt;
+    long ticks;
+    struct timespec t0;
+    long games, simulated;
+    pthread_t tid;
+} TickBench;
+
+static void* bench_ticks_func(void* arg) {
+    TickBench* b = arg;
+    trace_thread_name("bench");
+    while (b->simulated < b->ticks || elapsed_s(&b->t0) < BENCH_MIN_WALL_S) {
+        World* w = calloc(1, sizeof(World));
+        if (!w) { perror("calloc"); exit(1); }
+        w->headless = true;
+        w->config = b->opt->world;
+        w->difficulty = b->opt->difficulty ? b->opt->difficulty : 2;
+        w->seed = b->opt->seed + (unsigned)b->games;
+        init_game_elements(w);
+        HeliPolicy policy = { .kind = POLICY_AUTOPILOT, .world = w };
+        rng_seed(&policy.rng, w->seed, RNG_STREAM_POLICY);
+        long ticks = world_run_headless(w, &policy, b->ticks);
+        b->simulated += ticks > 0 ? ticks : 1; // garante o fim mesmo com partidas vazias
+        b->games++;
+        cleanup_game_resources(w);
+        free(w);
+    }
     return NULL;
 }
+
+/* Roda 'threads' cargas iguais ao mesmo tempo e soma em *total. */
+static double bench_games(const Options* opt, int threads, TickBench* total) {
+    TickBench* b = calloc((size_t)threads, sizeof(TickBench));
+    if (!b) { perror("calloc"); exit(1); }
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < threads; i++) {
+        b[i] = (TickBench){ .opt = opt, .ticks = opt->max_ticks, .t0 = t0 };
+        if (i > 0 && pthread_create(&b[i].tid, NULL, bench_ticks_func, &b[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    bench_ticks_func(&b[0]);
+    for (int i = 1; i < threads; i++) pthread_join(b[i].tid, NULL);
+    double wall_s = elapsed_s(&t0);
+
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < threads; i++) {
+        total->games += b[i].games;
+        total->simulated += b[i].simulated;
+    }
+    free(b);
+    return wall_s > 0 ? wall_s : 1e-9;
+}
+
+/* Uma rodada do escalonador (compartilhado, sem ator): soma mundos novos
+   até BENCH_MIN_WALL_S e devolve ticks por segundo. O mundo é
+   determinístico, então os contadores de um mundo (em *once) são os de
+   todos. */
+static double bench_sched_round(const Options* opt, const WorldConfig* config, int workers, SchedBenchResult* once) {
+    double wall_s = 0;
+    long ticks = 0;
+    while (wall_s < BENCH_MIN_WALL_S) {
+        double run_s = sched_bench_run(opt, config, workers, false, once);
+        if (run_s < 0) exit(1);
+        wall_s += run_s;
+        ticks += once->ticks;
+    }
+    return ticks / wall_s;
+}
+
+/* Um ponto medido. As rodadas de todos os pontos são intercaladas (rodada 1
+   de todos, depois a 2...), para que uma fase lenta da máquina, que dura
+   segundos, não caia em todas as rodadas de um mesmo ponto. */
+typedef enum { PROBE_SCHED, PROBE_GAMES, PROBE_RENDER } ProbeKind;
+
+typedef struct {
+    ProbeKind kind;
+    WorldConfig config;       // PROBE_SCHED
+    int threads;              // workers + 1 (PROBE_SCHED) ou partidas simultâneas (PROBE_GAMES)
+    double best[2];           // render: curses e ansi (us); demais: ticks/s
+    SchedBenchResult counts;  // PROBE_SCHED
+    RenderBenchResult render; // PROBE_RENDER
+} BenchProbe;
+
+static void bench_probe_round(const Options* opt, BenchProbe* p, bool warmup) {
+    double v[2] = { 0, 0 };
+    TickBench t;
+    double wall_s;
+    switch (p->kind) {
+        case PROBE_SCHED:
+            v[0] = bench_sched_round(opt, &p->config, p->threads - 1, &p->counts);
+            break;
+        case PROBE_GAMES:
+            wall_s = bench_games(opt, p->threads, &t);
+            v[0] = t.simulated / wall_s;
+            break;
+        case PROBE_RENDER:
+            if (!render_bench_measure(opt, BENCH_MIN_WALL_S / 2, &p->render)) exit(1);
+            v[0] = p->render.curses_us;
+            v[1] = p->render.ansi_us;
+            break;
+    }
+    if (warmup) return;
+    if (p->kind != PROBE_RENDER) {
+        if (v[0] > p->best[0]) p->best[0] = v[0];
+    } else {
+        for (int i = 0; i < 2; i++) {
+            if (p->best[i] == 0 || v[i] < p->best[i]) p->best[i] = v[i];
+        }
+    }
+}
+
+/* Latência entrada→tela no modo ator em tempo real: a tecla entra pela
+   caixa de comandos (como a do teclado), o timer do helicóptero a aplica e
+   a thread de renderização emite o quadro (ANSI em /dev/null). Cada amostra
+   espera um atraso aleatório antes da tecla para sortear a fase do timer. */
+static bool bench_latency(const Options* opt, double* samples_us, int n) {
+    World* w = calloc(1, sizeof(World));
+    int out_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (!w) { perror("calloc"); return false; }
+    if (out_fd < 0) { perror("/dev/null"); free(w); return false; }
+    w->config = opt->world;
+    w->config.battery_count = 0; // nada atira: mede o caminho da tecla, não a esquiva
+    w->difficulty = opt->difficulty ? opt->difficulty : 2;
+    w->seed = opt->seed;
+    w->actor = true;
+    init_game_elements(w);
+    RenderThreadArg render_arg = { w, snapshot_channel_create(w), RENDER_ANSI, out_fd };
+    HeliPolicy policy = { .kind = POLICY_KEYBOARD, .world = w };
+    rng_seed(&policy.rng, w->seed, RNG_STREAM_POLICY);
+    world_publish_snapshot(w);
+
+    Scheduler s;
+    pthread_t tid_scheduler, tid_render;
+    if (!scheduler_start(&s, w, 0, &policy)) return false;
+    if (pthread_create(&tid_scheduler, NULL, scheduler_thread_func, &s) != 0 ||
+        pthread_create(&tid_render, NULL, game_manager_thread_func, &render_arg) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+
+    Rng rng;
+    rng_seed(&rng, opt->seed, RNG_STREAM_POLICY + 1);
+    uint64_t start = (uint64_t)(uint32_t)w->helicopter.x << 32 | (uint32_t)w->helicopter.y;
+    bool ok = true;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (ok && atomic_load_explicit(&w->presented_heli, memory_order_acquire) != start) { // primeiro quadro
+        ok = elapsed_s(&t0) * 1000 < BENCH_LATENCY_TIMEOUT_MS;
+        usleep(1000);
+    }
+    for (int i = 0; ok && i < n; i++) {
+        usleep(rng_below(&rng, HELICOPTER_STEP_MS * 1000));
+        HeliCommand cmd = i % 2 == 0 ? CMD_UP : CMD_DOWN; // sobe e desce sem sair do lugar
+        uint64_t target = i % 2 == 0 ? start - 1 : start;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        command_queue_push(&w->commands, SIM_HELI_INPUT, cmd);
+        while (atomic_load_explicit(&w->presented_heli, memory_order_acquire) != target) {
+            ok = elapsed_s(&t0) * 1000 < BENCH_LATENCY_TIMEOUT_MS;
+            if (!ok) break;
+            usleep(100);
+        }
+        samples_us[i] = elapsed_s(&t0) * 1e6;
+    }
+    if (!ok) fprintf(stderr, "bench: o quadro com o helicoptero movido nao chegou\n");
+
+    world_shutdown(w);
+    pthread_join(tid_scheduler, NULL);
+    scheduler_stop(&s);
+    pthread_join(tid_render, NULL);
+    close(out_fd);
+    cleanup_game_resources(w);
+    free(w);
+    return ok;
+}
+
+static bool bench_write_json(const char* path, const Options* opt, const BenchReport* r) {
+    FILE* f = path ? fopen(path, "w") : stdout;
+    if (!f) { perror(path); return false; }
+    fprintf(f, "{\n  \"bench\": {\"version\": %d, \"seed\": %u, \"ticks\": %ld, \"difficulty\": %d, "
+               "\"jobs\": %d, \"simd\": \"%s\"},\n  \"metrics\": {\n",
+            BENCH_VERSION, opt->seed, opt->max_ticks, opt->difficulty ? opt->difficulty : 2, opt->jobs, BENCH_SIMD);
+    for (int i = 0; i < r->count; i++) {
+        fprintf(f, "    \"%s\": %.3f%s\n", r->m[i].name, r->m[i].value, i + 1 < r->count ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+    if (f != stdout) fclose(f);
+    return true;
+}
+
+/* Compara com um JSON anterior do --bench (só as linhas "nome": valor) e
+   lista cada métrica; retorna false se alguma piorou além da tolerância. */
+static bool bench_compare(const char* path, const BenchReport* r, double tolerance) {
+    FILE* f = fopen(path, "r");
+    if (!f) { perror(path); return false; }
+    BenchReport base = { .count = 0 };
+    char line[256];
+    while (fgets(line, sizeof line, f) && base.count < BENCH_MAX_METRICS) {
+        BenchMetric* m = &base.m[base.count];
+        if (sscanf(line, " \"%63[^\"]\": %lf", m->name, &m->value) == 2) base.count++;
+    }
+    fclose(f);
+
+    int regressions = 0;
+    fprintf(stderr, "Comparacao com %s:\n", path);
+    for (int i = 0; i < r->count; i++) {
+        const BenchMetric* cur = &r->m[i];
+        const BenchMetric* old = NULL;
+        for (int j = 0; j < base.count && !old; j++) {
+            if (strcmp(base.m[j].name, cur->name) == 0) old = &base.m[j];
+        }
+        if (!old || old->value == 0) {
+            fprintf(stderr, "  %-44s %14.2f (%s)\n", cur->name, cur->value, old ? "base 0" : "sem base");
+            continue;
+        }
+        double change = (cur->value - old->value) / old->value;
+        double worse = cur->kind == BENCH_COST ? change : -change;
+        double limit = strncmp(cur->name, "latency.", 8) == 0 ? tolerance * BENCH_LATENCY_FACTOR : tolerance;
+        bool regressed = cur->kind != BENCH_INFO && worse > limit;
+        regressions += regressed;
+        fprintf(stderr, "  %-44s %14.2f %+7.1f%%%s\n", cur->name, cur->value, change * 100,
+                regressed ? "  PIOROU" : cur->kind == BENCH_INFO && change != 0 ? "  (mudou; sem veredito)" : "");
+    }
+    fprintf(stderr, "%d metricas pioraram mais que %.0f%% (latencia: %.0f%%)\n",
+            regressions, tolerance * 100, tolerance * BENCH_LATENCY_FACTOR * 100);
+    return regressions == 0;
+}
+
+typedef struct {
+    BenchProbe* probes;
+    int count;
+    int render, scaling;   // índices do primeiro ponto de cada grupo
+    bool latency_ok;
+    double latency_us[4];  // média, p50, p95, máximo
+} BenchPlan;
+
+/* Baterias x foguetes, as saídas e, na escala, partidas independentes (como
+   o batch) e um mundo grande com o escalonador dividindo cada tick entre 1,
+   2, 4, ..., jobs threads. */
+static void bench_plan_init(const Options* opt, BenchPlan* plan) {
+    enum { GRID = sizeof bench_battery_counts / sizeof *bench_battery_counts *
+                  (sizeof bench_rocket_slots / sizeof *bench_rocket_slots) };
+    memset(plan, 0, sizeof(*plan));
+    plan->probes = calloc(GRID + 1 + 2 * 32, sizeof(BenchProbe)); // escala: no máximo 2 por potência de 2
+    if (!plan->probes) { perror("calloc"); exit(1); }
+    BenchProbe* probes = plan->probes;
+    int n = 0;
+    for (size_t i = 0; i < sizeof bench_battery_counts / sizeof *bench_battery_counts; i++) {
+        for (size_t j = 0; j < sizeof bench_rocket_slots / sizeof *bench_rocket_slots; j++) {
+            BenchProbe* p = &probes[n++];
+            *p = (BenchProbe){ .kind = PROBE_SCHED, .config = opt->world, .threads = 1 };
+            p->config.battery_count = bench_battery_counts[i];
+            p->config.rocket_slots = bench_rocket_slots[j];
+        }
+    }
+    plan->render = n;
+    probes[n++] = (BenchProbe){ .kind = PROBE_RENDER };
+    plan->scaling = n;
+    for (int jobs = 1;; jobs = jobs * 2 < opt->jobs ? jobs * 2 : opt->jobs) {
+        probes[n++] = (BenchProbe){ .kind = PROBE_GAMES, .threads = jobs };
+        probes[n] = (BenchProbe){ .kind = PROBE_SCHED, .config = opt->world, .threads = jobs };
+        probes[n++].config.battery_count = BENCH_SCALING_BATTERIES;
+        if (jobs == opt->jobs) break;
+    }
+    plan->count = n;
+}
+
+/* BENCH_REPEATS rodadas intercaladas de todos os pontos; cada ponto guarda
+   a melhor rodada vista até agora, então chamar de novo só acrescenta
+   amostras. */
+static void bench_plan_rounds(const Options* opt, BenchPlan* plan) {
+    for (int round = 0; round < BENCH_REPEATS; round++) {
+        for (int i = 0; i < plan->count; i++) bench_probe_round(opt, &plan->probes[i], false);
+    }
+}
+
+static void bench_plan_report(const BenchPlan* plan, BenchReport* r, int jobs) {
+    const BenchProbe* probes = plan->probes;
+    r->count = 0;
+    fprintf(stderr, "Ticks simulados (helicoptero parado):\n");
+    for (int i = 0; i < plan->render; i++) {
+        const BenchProbe* p = &probes[i];
+        int b = p->config.battery_count, k = p->config.rocket_slots;
+        double kticks = p->counts.ticks / 1000.0;
+        bench_metric(r, BENCH_RATE, p->best[0], "ticks.b%d.r%d.ticks_per_s", b, k);
+        bench_metric(r, BENCH_INFO, (double)p->counts.fired / p->counts.ticks, "ticks.b%d.r%d.timers_per_tick", b, k);
+        bench_metric(r, BENCH_INFO, p->counts.crossings / kticks, "ticks.b%d.r%d.bridge_crossings_per_ktick", b, k);
+        bench_metric(r, BENCH_INFO, p->counts.admissions / kticks, "ticks.b%d.r%d.depot_admissions_per_ktick", b, k);
+    }
+
+    fprintf(stderr, "Saidas:\n");
+    const BenchProbe* rp = &probes[plan->render];
+    bench_metric(r, BENCH_COST, rp->best[0], "render.curses.frame_us");
+    bench_metric(r, BENCH_COST, rp->render.curses_bytes, "render.curses.frame_bytes");
+    bench_metric(r, BENCH_COST, rp->best[1], "render.ansi.frame_us");
+    bench_metric(r, BENCH_COST, rp->render.ansi_bytes, "render.ansi.frame_bytes");
+
+    fprintf(stderr, "Latencia entrada->tela (modo ator, %d amostras):\n", BENCH_LATENCY_SAMPLES);
+    if (plan->latency_ok) {
+        bench_metric(r, BENCH_COST, plan->latency_us[0], "latency.input_to_display.mean_us");
+        bench_metric(r, BENCH_COST, plan->latency_us[1], "latency.input_to_display.p50_us");
+        bench_metric(r, BENCH_INFO, plan->latency_us[2], "latency.input_to_display.p95_us");
+        bench_metric(r, BENCH_INFO, plan->latency_us[3], "latency.input_to_display.max_us");
+    }
+
+    fprintf(stderr, "Escala ate %d nucleos:\n", jobs);
+    const BenchProbe* one = &probes[plan->scaling];
+    for (int i = plan->scaling; i < plan->count; i += 2) {
+        const BenchProbe* games = &probes[i];
+        const BenchProbe* sched = &probes[i + 1];
+        int j = games->threads;
+        double timers_per_tick = (double)sched->counts.fired / sched->counts.ticks;
+        bench_metric(r, BENCH_RATE, games->best[0], "scaling.games.j%d.ticks_per_s", j);
+        bench_metric(r, BENCH_INFO, games->best[0] / one[0].best[0], "scaling.games.j%d.speedup", j);
+        bench_metric(r, BENCH_RATE, sched->best[0] * timers_per_tick, "scaling.scheduler.j%d.timers_per_s", j);
+        bench_metric(r, BENCH_INFO, sched->best[0] / one[1].best[0], "scaling.scheduler.j%d.speedup", j);
+    }
+}
+
+/* --bench: ticks/s por baterias x foguetes (com travessias da ponte e
+   entradas no depósito por mil ticks), custo das saídas, latência
+   entrada→tela e escala de 1 a --jobs núcleos. Texto em stderr, JSON em
+   --report ou stdout. Se algo piorou contra a base, mede mais uma vez
+   antes de falhar: uma fase lenta da máquina passa, uma regressão não. */
+int run_bench_suite(const Options* opt) {
+    BenchReport* r = calloc(1, sizeof(BenchReport));
+    if (!r) { perror("calloc"); return 1; }
+    BenchPlan plan;
+    bench_plan_init(opt, &plan);
+
+    fprintf(stderr, "Medindo %d pontos, %d rodadas intercaladas (%ld ticks por mundo)...\n",
+            plan.count, BENCH_REPEATS, opt->max_ticks);
+    for (int i = 0; i < plan.count; i++) bench_probe_round(opt, &plan.probes[i], true); // aquecimento
+    bench_plan_rounds(opt, &plan);
+
+    double samples[BENCH_LATENCY_SAMPLES];
+    plan.latency_ok = bench_latency(opt, samples, BENCH_LATENCY_SAMPLES);
+    if (plan.latency_ok) {
+        double sum = 0;
+        for (int i = 0; i < BENCH_LATENCY_SAMPLES; i++) sum += samples[i];
+        plan.latency_us[0] = sum / BENCH_LATENCY_SAMPLES;
+        plan.latency_us[1] = bench_median(samples, BENCH_LATENCY_SAMPLES); // também ordena
+        plan.latency_us[2] = samples[BENCH_LATENCY_SAMPLES * 95 / 100];
+        plan.latency_us[3] = samples[BENCH_LATENCY_SAMPLES - 1];
+    }
+    bench_plan_report(&plan, r, opt->jobs);
+
+    bool ok = true;
+    if (opt->baseline_path && !bench_compare(opt->baseline_path, r, opt->bench_tolerance)) {
+        fprintf(stderr, "Confirmando com mais %d rodadas...\n", BENCH_REPEATS);
+        bench_plan_rounds(opt, &plan);
+        bench_plan_report(&plan, r, opt->jobs);
+        ok = bench_compare(opt->baseline_path, r, opt->bench_tolerance);
+    }
+    ok = bench_write_json(opt->report_path, opt, r) && ok;
+    free(plan.probes);
+    free(r);
+    return ok ? 0 : 1;
+}